@@ -24,85 +24,91 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
-#include <util/delay.h>
+#include <avr/pgmspace.h>
 
+#include "board.h"
+#include "buttons.h"
 #include "buzzer.h"
+#include "eelog.h"
+#include "entropy.h"
+#include "latency.h"
+#include "rand.h"
+#include "record.h"
+#include "systick.h"
+#include "task.h"
+#include "telemetry.h"
 
 /*---------------------------------------------------------------------------*
   HARDWARE ABSTRACTION LAYER (HAL)
   These methods hide and abstract all the hardware details of the specific
   Simon board: ports where leds and buttons, plus hardware-specific approach
-  to random number generation. All ports are hard-coded in these methods.
+  to random number generation. All ports are defined in board.h.
   Methods that are used only once are hand-marked as inline.
  *---------------------------------------------------------------------------*/
 
-// Utility macros to work with ports
-#define sbi(reg, bit)          (reg |= _BV(bit))
-#define cbi(reg, bit)          (reg &= ~_BV(bit))
-#define getbit(reg, bit)       (reg & _BV(bit))
-#define setbit(reg, bit, val) \
-	if (val) sbi(reg, bit);   \
-	    else cbi(reg, bit);
-
-// Bit masks that define leds and buttons for set_leds and get_buttons
+// Bit masks that define leds and buttons for set_leds and get_buttons (see board.h)
 #define LED0 _BV(0)
 #define LED1 _BV(1)
 #define LED2 _BV(2)
 #define LED3 _BV(3)
 
 // Initializes hardware abstraction layer
-inline void hal_init() {
+inline static void hal_init() {
 	// 1 = output, 0 = input
-	DDRB = 0b11111100;  // buttons 2,3 on PB0,1
-	DDRD = 0b00111110;  // LEDs, buttons, buzzer, TX/RX
+	BOARD_DDR(1) = BOARD_DDR1;
+	BOARD_DDR(2) = BOARD_DDR2;
 
-	PORTB = 0b00000011; // Enable pull-ups on buttons 2,3
-	PORTD = 0b11000000; // Enable pull-ups on buttons 0,1
+	BOARD_PORT(1) = BUTTONS_MASK(1); // Enable pull-ups on buttons
+	BOARD_PORT(2) = BUTTONS_MASK(2);
+	buttons_init();
 
 	// Use timer0 & timer2 for random number generation (see random method)
-	// Together they will act like a 16bit timer
-	TCCR0B = _BV(CS00);             // Run timer0 1:1   with CPU clock (no prescaler)
+	// Timer0 counts within a millisecond for system tick, that also debounces buttons
+	systick_init();
 	TCCR2B = _BV(CS22) | _BV(CS21); // Run timer2 1:256 with CPU clock
 
+	// Turn off analog comparator, ADC, TWI, SPI and USART to save power
+	ACSR = _BV(ACD);
+	ADCSRA = 0; // ADC must be disabled before it is shut down
+	PRR = MCU_PRR_UNUSED;
+	telemetry_init(); // USART is turned back on with TELEMETRY
+
 	// Enable global interrupts (it is required for buzzer)
 	sei();
 }
 
-// Lights leds according to bitmask
-void set_leds(uint8_t mask) {
-	setbit(PORTB, 2, mask & LED0);
-	setbit(PORTD, 2, mask & LED1);
-	setbit(PORTB, 5, mask & LED2);
-	setbit(PORTD, 5, mask & LED3);
-}
+// Lookup tables from leds bitmask to port bits (see board.h)
+const uint8_t LEDS_P1[16] PROGMEM = BOARD_TABLE16(LEDS_ON, 1);
+const uint8_t LEDS_P2[16] PROGMEM = BOARD_TABLE16(LEDS_ON, 2);
 
-// Returns bitmask of buttons pressed
-uint8_t get_buttons() {
-	uint8_t mask = 0;
-	if (!getbit(PINB, 0)) mask |= LED0;
-	if (!getbit(PINB, 1)) mask |= LED1;
-	if (!getbit(PIND, 7)) mask |= LED2;
-	if (!getbit(PIND, 6)) mask |= LED3;
-	return mask;
+// Lights leds according to bitmask with a single write to each port
+void set_leds(uint8_t mask) {
+	uint8_t p1 = pgm_read_byte(&LEDS_P1[mask & 0x0f]);
+	uint8_t p2 = pgm_read_byte(&LEDS_P2[mask & 0x0f]);
+	// read-modify-write must not lose buzzer pin flips from ISR
+	uint8_t sreg = SREG;
+	cli();
+	BOARD_PORT(1) = (BOARD_PORT(1) & ~LEDS_MASK(1)) | p1;
+	BOARD_PORT(2) = (BOARD_PORT(2) & ~LEDS_MASK(2)) | p2;
+	SREG = sreg;
 }
 
-// Typedef for random seed
-typedef union {
-	uint32_t value;
-	uint8_t bytes[4];
-} rand_seed_t;
-
 // Current seed for random()
 rand_seed_t rand_seed;
 
-// Generates random byte using timer0&2 as randomness source
-inline uint8_t random() {
+// Generates random byte using entropy pool and timer0&2 as randomness source
+inline static uint8_t random() {
 	rand_seed_t cur = rand_seed;
-	cur.bytes[0] ^= TCNT0; // mangle seed based on timer0
-	cur.bytes[1] ^= TCNT2; // mangle seed based on timer2
-	cur.value = (cur.value * 22695477L + 1); // linear congruent PRNG
+	uint16_t pool = take_entropy(); // timing of button presses and tones so far
+	rand_mix(&cur, TCNT0 ^ (uint8_t)pool, TCNT2 ^ (uint8_t)(pool >> 8));
+	uint8_t res = rand_next(&cur); // PRNG step spreads them over the whole seed (see rand.h)
 	rand_seed = cur;
-	return cur.bytes[3]; // use most significant byte as random value
+	return res;
+}
+
+// Returns next random button 0..3 deterministically from the seed (no timer mangling)
+inline static uint8_t next_random_button(rand_seed_t *seed) {
+	return rand_next(seed) >> 6; // use most significant bits as random value
 }
 
 /*---------------------------------------------------------------------------*
@@ -110,23 +116,22 @@ inline uint8_t random() {
   These methods provide utility function for button debouncing and counting.
  *---------------------------------------------------------------------------*/
 
-#define DEBOUNCE_MS 5  // debounce delay in ms
-
 // Waits for button(s) press and release until timeout (ms) with debounce
 uint8_t wait_buttons(uint16_t time_ms) {
+	uint16_t start = millis();
 	uint8_t res = 0; // resulting buttons mask
-	uint8_t cur = 0; // currently pressed buttons
-	do {
-		cur = get_buttons();
-		res |= cur;
-		_delay_ms(DEBOUNCE_MS); // this delay de-bounces read
-		time_ms -= DEBOUNCE_MS;
-	} while (time_ms >= DEBOUNCE_MS && (res == 0 || cur != 0));
-	return res;
+	uint8_t cur;     // currently pressed buttons
+	while (1) {
+		cur = get_stable_buttons();
+		res |= take_pressed_buttons() | cur;
+		if ((res != 0 && cur == 0) || (uint16_t)(millis() - start) >= time_ms)
+			return res;
+		sleep_idle(); // buttons are sampled on system tick
+	}
 }
 
 // Counts the number of button(s) pressed
-inline uint8_t buttons_count(uint8_t mask) {
+inline static uint8_t buttons_count(uint8_t mask) {
 	uint8_t cnt = 0;
 	if (mask & LED0) cnt++;
 	if (mask & LED1) cnt++;
@@ -142,7 +147,7 @@ inline uint8_t buttons_count(uint8_t mask) {
  *---------------------------------------------------------------------------*/
 
 // Plays the loser sounds
-inline void play_loser(void) {
+inline static void play_loser(void) {
 	uint8_t i;
 	for (i = 0; i < 4; i++) {
 		set_leds((i & 1) ? (LED2 | LED3) : (LED0 | LED1));
@@ -150,37 +155,25 @@ inline void play_loser(void) {
 	}
 }
 
-// Next tone for play_winner
-volatile uint8_t winner_tone;
-
-// Plays current winner tone and decrements it for a higher note next
-void next_winner_tone() {
-	uint8_t tone = winner_tone;
-	if (tone > 70) {
-		start_buzzer(tone * (F_CPU / 1000000), 6, &next_winner_tone);
-		winner_tone = tone - 1;
-	} else {
-		stop_buzzer();
-	}
-}
-
 // Plays the winner sounds
-inline void play_winner(void) {
+inline static void play_winner(void) {
 	uint8_t i;
+	uint8_t tone;
 	for (i = 0; i < 4; i++) {
 		set_leds((i & 1) ? (LED0 | LED3) : (LED1 | LED2));
-		winner_tone = 250;
-		next_winner_tone();
-		while (is_buzzer_working());
+		// queue a sweep of higher and higher short notes (half period from 250us down to 71us)
+		for (tone = 250; tone > 70; tone--)
+			queue_buzzer(US2TONE(tone), 0, 6);
+		wait_buzzer();
 	}
 }
 
 // Indicate the start of game play
 inline static void play_start() {
 	set_leds(LED0 | LED1 | LED2 | LED3);
-	_delay_ms(1000);
-	 set_leds(0);
-	_delay_ms(250);
+	sleep_ms(1000);
+	set_leds(0);
+	sleep_ms(250);
 }
 
 /*---------------------------------------------------------------------------*
@@ -189,22 +182,51 @@ inline static void play_start() {
   sequence, and perform overall logic of a single game.
  *---------------------------------------------------------------------------*/
 
-#define MAX_GAME_LEVEL 64
+#define MAX_GAME_LEVEL 255 // game_position and game_level are 8 bit
 #define WINNER 1
 #define LOSER  0
 
+#define IDLE_TIMEOUT_MS 30000 // Power down when nobody starts a game for this long
+
+// Game tuning, can be overridden during compilation
+#ifndef PRESS_TIMEOUT_MS
+#define PRESS_TIMEOUT_MS 3000 // Player loses when no button is pressed for this long
+#endif
+#ifndef LEVEL_2_BUTTONS
+#define LEVEL_2_BUTTONS 15    // Game level when game starts with 2 buttons
+#endif
+#ifndef LEVEL_3_BUTTONS
+#define LEVEL_3_BUTTONS 20    // ... with 3 buttons
+#endif
+#ifndef LEVEL_4_BUTTONS
+#define LEVEL_4_BUTTONS 25    // ... with 4 buttons
+#endif
+
 // Play button tone for 150 ms
 #define BUTTON_LENGTH_MS 150
 
-// Button Tone and Count array entries generation macro
+// Button Tone, fraction and Count array entries generation macro
 #define BTC(freq) FREQLEN2TONECNT(freq, BUTTON_LENGTH_MS)
 
 // Current game variables
-uint8_t game_sequence[MAX_GAME_LEVEL]; // contains 0..3 button numbers for a game
+rand_seed_t game_seed;                 // seed that regenerates 0..3 button numbers for a game
 uint8_t game_position;                 // current game position from 0
 uint8_t game_level = 5;                // default game level if game starts with single button press.
+uint8_t game_best;                     // longest sequence ever repeated (high score)
+uint8_t game_health;                   // estimated entropy bits in game_seed
+
+// Sequential iterator over game sequence that regenerates it from game_seed
+typedef struct {
+	rand_seed_t seed; // PRNG state for the next button
+	uint8_t pos;      // current position from 0
+} game_iter_t;
 
-uint16_t BUTTONS[8] = {
+#ifdef TELEMETRY
+game_iter_t game_gen; // regenerates buttons as they are added to the game to report them
+#endif
+
+// Button tone, fraction and count triples are computed at compile time and kept in flash
+const uint16_t BUTTONS[12] PROGMEM = {
 		BTC(440.00), // (red, upper left) - 440Hz
 		BTC(880.00), // (green, upper right, an octave higher than the upper right) - 880Hz
 		BTC(587.33), // (blue, lower left, a perfect fourth higher than the upper left) - 587.33Hz
@@ -214,79 +236,169 @@ uint16_t BUTTONS[8] = {
 // Generates button tone and highlights the corresponding button
 void button_tone(uint8_t button) {
 	set_leds(_BV(button)); // Turn on button led
-	uint16_t *btc = &BUTTONS[2 * button]; // Pointer to BTC entry for the button
-	buzzer_wait(*btc, *(btc + 1));
+	latency_mark(LATENCY_LED);
+	start_buzzer_P(&BUTTONS[3 * button]); // Play BTC entry for the button from flash
+	latency_mark(LATENCY_SOUND);
+	wait_buzzer();
 	set_leds(0);           // Turn off all LEDs
 }
 
-// Starts new game
-inline void new_game_sequence() {
-	game_position = 0;
+// Starts iteration over the game sequence from its beginning
+inline static void game_iter_start(game_iter_t *it) {
+	it->seed = game_seed;
+	it->pos = 0;
+}
+
+// Returns true if the iterator has not reached current game position yet
+inline static uint8_t game_iter_has_next(game_iter_t *it) {
+	return it->pos < game_position;
+}
+
+// Returns next button of the game sequence
+inline static uint8_t game_iter_next(game_iter_t *it) {
+	it->pos++;
+	return next_random_button(&it->seed);
+}
+
+// Starts new game with a fresh seed from timers, the whole game is reproducible from it
+inline static void new_game_sequence() {
+	game_health = entropy_health();
+	random(); // mangle seed based on timers
+	game_seed = rand_seed;
 }
 
 // Adds a new random button to the game sequence
-inline void add_to_game_sequence(void) {
-	game_sequence[game_position++] = random() & 3;
+inline static void add_to_game_sequence(void) {
+#ifdef TELEMETRY
+	uint8_t pos = game_gen.pos;
+	telemetry_event(TELEMETRY_STEP, pos, game_iter_next(&game_gen));
+#endif
+	game_position++;
+}
+
+// Task that plays the current contents of the game sequence
+uint8_t playback_task(task_t *t) {
+	static game_iter_t it;
+	static uint8_t button;
+	TASK_BEGIN(t);
+	game_iter_start(&it);
+	while (game_iter_has_next(&it)) {
+		button = game_iter_next(&it);
+		set_leds(_BV(button)); // Turn on button led
+		start_buzzer_P(&BUTTONS[3 * button]);
+		TASK_WAIT_UNTIL(t, !is_buzzer_working());
+		set_leds(0);           // Turn off all LEDs
+		TASK_DELAY(t, 150);
+	}
+	TASK_END(t);
 }
 
 // Plays the current contents of the game sequence
+// Playback stops as soon as a button is pressed, the press is left for test_game_sequence
 inline static void play_game_sequence(void) {
-	uint8_t pos;
-	for (pos = 0; pos < game_position; pos++) {
-		button_tone(game_sequence[pos]);
-		_delay_ms(150);
+	task_t playback;
+	TASK_INIT(&playback);
+	take_pressed_buttons(); // presses before playback do not count
+	while (!playback_task(&playback)) {
+		if (has_pressed_buttons()) {
+			stop_buzzer();
+			set_leds(0);
+			return;
+		}
+		sleep_idle();
 	}
 }
 
+// Task that displays fancy chase LED pattern
+uint8_t chase_task(task_t *t) {
+	static uint8_t led;
+	TASK_BEGIN(t);
+	for (led = LED0;; led = led == LED3 ? LED0 : led << 1) {
+		set_leds(led);
+		TASK_DELAY(t, 100);
+	}
+	TASK_END(t);
+}
+
 // Display fancy LED pattern waiting for any button to be pressed
 // Wait for user to begin game
 inline static void wait_start() {
 	uint8_t mask = 0;
 	uint8_t buttons;
 	uint8_t cnt;
-	uint8_t led = LED0;
-
-	do {
-		set_leds(led);
-		mask = wait_buttons(100); // 100ms max wait
-		led = led == LED3 ? LED0 : led << 1; // next led
-	} while (mask == 0);
+	task_t chase;
+	uint16_t timeout;
+
+	// run chase pattern while checking buttons on every tick
+	take_pressed_buttons(); // presses during previous effects do not count
+	TASK_INIT(&chase);
+	timeout = millis() + IDLE_TIMEOUT_MS;
+	while ((mask = take_pressed_buttons() | get_stable_buttons()) == 0) {
+		if ((int16_t)(millis() - timeout) >= 0 && !is_eelog_busy()) {
+			// nobody plays -- turn leds off and power down until any button is touched
+			set_leds(0);
+			sleep_power_down();
+			TASK_INIT(&chase);
+			timeout = millis() + IDLE_TIMEOUT_MS;
+			continue;
+		}
+		if (take_telemetry_request()) { // on demand from serial port
+			latency_dump();
+		}
+		chase_task(&chase);
+		sleep_idle();
+	}
 
 	// wait more until all buttons are released
 	set_leds(0);
 	buttons = mask;
 	do {
-		mask = get_buttons();
-		buttons |= mask;
+		sleep_idle();
+		mask = get_stable_buttons();
+		buttons |= mask | take_pressed_buttons();
 	} while (mask != 0);
 
 	// configure game level depending on number of buttons pressed
 	cnt = buttons_count(buttons);
 	if (cnt == 2)
-		game_level = 15;
+		game_level = LEVEL_2_BUTTONS;
 	else if (cnt == 3)
-		game_level = 20;
+		game_level = LEVEL_3_BUTTONS;
 	else if (cnt == 4)
-		game_level = 25;
+		game_level = LEVEL_4_BUTTONS;
 }
 
 // Tests if game sequence is pressed correctly, returns WINNER or LOSER
 inline static uint8_t test_game_sequence() {
 	uint8_t mask;
-	uint8_t pos;
-	for (pos = 0; pos < game_position; pos++) {
-		mask = wait_buttons(3000); // Wait at most 3 sec for button press
-		if (mask != _BV(game_sequence[pos]))
+	uint8_t button;
+	game_iter_t it;
+	game_iter_start(&it);
+	while (game_iter_has_next(&it)) {
+		button = game_iter_next(&it);
+		mask = wait_buttons(PRESS_TIMEOUT_MS); // Wait for button press or time out
+#ifdef TELEMETRY
+		// stamp the press when it was debounced, wait_buttons returns only after release
+		telemetry_event_at(TELEMETRY_PRESS, mask ? get_pressed_ms() : millis(), mask, 0);
+#endif
+		record_flush(); // stream the session while the player thinks
+		if (mask != _BV(button))
 			return LOSER;
 		// Fire the button and play the button tone
-		button_tone(game_sequence[pos]);
+		button_tone(button);
 	}
 	return WINNER;
 }
 
-// Plays a single game and returns WINNER or LOSER
-inline static uint8_t single_game() {
-	new_game_sequence();
+// Plays a game of game_level from game_seed and returns WINNER or LOSER
+// (a recorded session is replayed from here, see tools/replay.c)
+inline static uint8_t play_game() {
+	game_position = 0;
+#ifdef TELEMETRY
+	game_iter_start(&game_gen);
+#endif
+	telemetry_event(TELEMETRY_START, game_level, game_health);
+	record_start(game_level, &game_seed, sizeof(game_seed));
 	while (1) {
 		add_to_game_sequence();    // Add the button to the game sequence
 		play_game_sequence();      // Play the current contents of the game sequence back for the player
@@ -296,27 +408,63 @@ inline static uint8_t single_game() {
 		if (game_position == game_level)
 			return WINNER;
 		// Otherwise, we need to wait just a hair before we play back longer sequence again
-		_delay_ms(1000);
+		sleep_ms(1000);
 	}
 }
 
+// Plays a single game with a new sequence and returns WINNER or LOSER
+inline static uint8_t single_game() {
+	new_game_sequence();
+	return play_game();
+}
+
 /*---------------------------------------------------------------------------*
   MAIN
   Brings it all together
  *---------------------------------------------------------------------------*/
 
+// Restores level and high score from EEPROM, saved gets the values that are stored there
+inline static void restore_game(eelog_record_t *saved) {
+	if (eelog_init(saved) && saved->level != 0) {
+		game_level = saved->level;
+		game_best = saved->best;
+	} else
+		saved->level = 0; // nothing to compare with
+}
+
+// Ends a game with its result: updates level and high score, plays the result and
+// saves them when changed
+inline static void end_game(uint8_t result, eelog_record_t *saved) {
+	uint8_t score;
+	record_stop();
+	telemetry_event(TELEMETRY_RESULT, result, game_level);
+	score = result ? game_position : game_position - 1;
+	if (score > game_best)
+		game_best = score;
+	if (result) {
+		play_winner();
+		if (game_level < MAX_GAME_LEVEL)
+			game_level++; // Next level (stays at max level once reached)
+	} else {
+		play_loser();
+	}
+	// Save in background when changed, at most one record per game
+	if (game_level != saved->level || game_best != saved->best) {
+		eelog_save(game_level, game_best);
+		saved->level = game_level;
+		saved->best = game_best;
+	}
+}
+
 void main() __attribute__ ((noreturn));
 
 void main() {
-	hal_init();  // Setup IO pins and defaults
-	while (1) {  // Repeatedly play games
+	eelog_record_t saved;
+	hal_init();            // Setup IO pins and defaults
+	restore_game(&saved);  // Restore level and high score
+	while (1) {            // Repeatedly play games
 		wait_start();
 		play_start();
-		if (single_game()) {
-			play_winner();
-			game_level++; // Next level
-		} else {
-			play_loser();
-		}
+		end_game(single_game(), &saved);
 	}
 }
@@ -0,0 +1,158 @@
+/******************************************************************************
+ * Pin map of Simon boards.
+ * A board is defined declaratively by the two I/O ports it uses, bitmasks of
+ * every led and button on port 1 and on port 2 (zero when it is on the other
+ * port), buzzer pins and initial port directions. Select a board with
+ * BOARD=<id> during compilation (BOARD_SPARKFUN by default). Everything is
+ * expanded by the preprocessor into constant I/O addresses and lookup tables,
+ * so the generated code is the same as hand-written port access.
+ * Registers that differ between AVR families (power reduction, pin change
+ * interrupt control, USART) are named in a per-MCU section, selected by the
+ * -mmcu of the compiler; the rest of the code uses only these names besides
+ * Timer0, Timer1 and Timer2 registers, which are the same on all MCUs there.
+ * tools/compare.sh checks that code stays the same across a refactoring.
+ *****************************************************************************/
+
+#ifndef BOARD_H_
+#define BOARD_H_
+
+#include <avr/io.h>
+
+// Supported MCUs
+#if defined(__AVR_ATmega48__) || defined(__AVR_ATmega48A__) || defined(__AVR_ATmega48P__) || \
+	defined(__AVR_ATmega88__) || defined(__AVR_ATmega88A__) || defined(__AVR_ATmega88P__) || \
+	defined(__AVR_ATmega168__) || defined(__AVR_ATmega168A__) || defined(__AVR_ATmega168P__) || \
+	defined(__AVR_ATmega328__) || defined(__AVR_ATmega328P__)
+
+// Power reduction bits of peripherals that are never used, and of USART
+#define MCU_PRR_UNUSED (_BV(PRTWI) | _BV(PRSPI) | _BV(PRUSART0) | _BV(PRADC))
+#define MCU_PRR_USART  _BV(PRUSART0)
+
+// Pin change interrupt flag and control registers
+#define MCU_PCIFR      PCIFR
+#define MCU_PCICR      PCICR
+
+// USART registers, bits and vectors
+#define MCU_UDR        UDR0
+#define MCU_UCSRA      UCSR0A
+#define MCU_UCSRB      UCSR0B
+#define MCU_UCSRC      UCSR0C
+#define MCU_UBRR       UBRR0
+#define MCU_U2X        U2X0
+#define MCU_UCSZ0      UCSZ00
+#define MCU_UCSZ1      UCSZ01
+#define MCU_TXEN       TXEN0
+#define MCU_RXEN       RXEN0
+#define MCU_RXCIE      RXCIE0
+#define MCU_UDRIE      UDRIE0
+#define MCU_USART_RX_vect   USART_RX_vect
+#define MCU_USART_UDRE_vect USART_UDRE_vect
+
+#else
+#error Unsupported MCU
+#endif
+
+// Known boards
+#define BOARD_SPARKFUN 1 // SparkFun Simon on ATmega168/ATmega328P
+
+#ifndef BOARD
+#define BOARD BOARD_SPARKFUN
+#endif
+
+#if BOARD == BOARD_SPARKFUN
+
+// I/O ports (letters)
+#define BOARD_P1   B
+#define BOARD_P2   D
+
+// Pin change interrupt groups of ports (PCINT0..7 on port B, PCINT16..23 on port D)
+#define BOARD_PCI1 0
+#define BOARD_PCI2 2
+
+// Port directions (1 = output), unused pins are outputs to save power
+#define BOARD_DDR1 0b11111100 // buttons on PB0,1
+#define BOARD_DDR2 0b00111110 // LEDs, buttons, buzzer, TX/RX
+
+// Leds (1 = on)
+#define LED0_P1    _BV(2)
+#define LED0_P2    0
+#define LED1_P1    0
+#define LED1_P2    _BV(2)
+#define LED2_P1    _BV(5)
+#define LED2_P2    0
+#define LED3_P1    0
+#define LED3_P2    _BV(5)
+
+// Buttons (0 = pressed, pull-ups are enabled)
+#define BUTTON0_P1 _BV(0)
+#define BUTTON0_P2 0
+#define BUTTON1_P1 _BV(1)
+#define BUTTON1_P2 0
+#define BUTTON2_P1 0
+#define BUTTON2_P2 _BV(7)
+#define BUTTON3_P1 0
+#define BUTTON3_P2 _BV(6)
+
+// Buzzer legs (BUZZER_BIT1 must be on OC2B for BUZZER_TIMER2)
+#define BUZZER_PORT1 PORTD
+#define BUZZER_PIN1  PIND
+#define BUZZER_BIT1  3
+#define BUZZER_PORT2 PORTD
+#define BUZZER_PIN2  PIND
+#define BUZZER_BIT2  4
+
+// USART receiver pin of telemetry (must be on RXD)
+#define RXD_PORT     PORTD
+#define RXD_BIT      0
+
+#else
+#error Unknown BOARD
+#endif
+
+// I/O registers of port n (1 or 2)
+#define BOARD_CAT(a, b)      a##b
+#define BOARD_XCAT(a, b)     BOARD_CAT(a, b)
+#define BOARD_PORT(n)        BOARD_XCAT(PORT, BOARD_P##n)
+#define BOARD_PIN(n)         BOARD_XCAT(PIN, BOARD_P##n)
+#define BOARD_DDR(n)         BOARD_XCAT(DDR, BOARD_P##n)
+
+// Pin change interrupt mask register, enable bit and vector of port n (1 or 2)
+#define BOARD_PCMSK(n)       BOARD_XCAT(PCMSK, BOARD_PCI##n)
+#define BOARD_PCIE(n)        _BV(BOARD_XCAT(PCIE, BOARD_PCI##n))
+#define BOARD_PCINT_vect(n)  BOARD_XCAT(PCINT, BOARD_XCAT(BOARD_PCI##n, _vect))
+
+// Bitmask of port n (1 or 2) bits for leds from mask
+#define LEDS_ON(n, mask) \
+	((((mask) & 1) ? LED0_P##n : 0) | (((mask) & 2) ? LED1_P##n : 0) | \
+	 (((mask) & 4) ? LED2_P##n : 0) | (((mask) & 8) ? LED3_P##n : 0))
+
+// Bitmask of all leds on port n (1 or 2)
+#define LEDS_MASK(n)         LEDS_ON(n, 0x0f)
+
+// Bitmask of buttons pressed according to value of port n (1 or 2) pins
+#define BUTTONS_ON(n, pin) \
+	((BUTTON0_P##n && !((pin) & BUTTON0_P##n) ? 1 : 0) | (BUTTON1_P##n && !((pin) & BUTTON1_P##n) ? 2 : 0) | \
+	 (BUTTON2_P##n && !((pin) & BUTTON2_P##n) ? 4 : 0) | (BUTTON3_P##n && !((pin) & BUTTON3_P##n) ? 8 : 0))
+
+// Bitmask of all buttons on port n (1 or 2)
+#define BUTTONS_MASK(n)      (BUTTON0_P##n | BUTTON1_P##n | BUTTON2_P##n | BUTTON3_P##n)
+
+// Number of the lowest set bit in mask (0 for empty mask)
+#define LOWEST_BIT(mask) \
+	((mask) & 0x01 ? 0 : (mask) & 0x02 ? 1 : (mask) & 0x04 ? 2 : (mask) & 0x08 ? 3 : \
+	 (mask) & 0x10 ? 4 : (mask) & 0x20 ? 5 : (mask) & 0x40 ? 6 : (mask) & 0x80 ? 7 : 0)
+
+// Shift of port n (1 or 2) pins to get 4-bit index into buttons lookup table
+#define BUTTONS_SHIFT(n)     LOWEST_BIT(BUTTONS_MASK(n))
+
+// Lookup table entry for buttons on port n (1 or 2) at 4-bit index
+#define BUTTONS_ENTRY(n, i)  BUTTONS_ON(n, (i) << BUTTONS_SHIFT(n))
+
+// Initializer of a 16 entry lookup table for port n (1 or 2) with entry(n, i)
+#define BOARD_TABLE16(entry, n) { \
+	entry(n, 0),  entry(n, 1),  entry(n, 2),  entry(n, 3),  \
+	entry(n, 4),  entry(n, 5),  entry(n, 6),  entry(n, 7),  \
+	entry(n, 8),  entry(n, 9),  entry(n, 10), entry(n, 11), \
+	entry(n, 12), entry(n, 13), entry(n, 14), entry(n, 15)  }
+
+#endif /* BOARD_H_ */
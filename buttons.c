@@ -0,0 +1,74 @@
+/******************************************************************************
+ * Debounced buttons.
+ *****************************************************************************/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include "buttons.h"
+
+// Buttons on each port must fit into 4 bits starting from the lowest one
+typedef char buttons_p1_check[(BUTTONS_MASK(1) >> BUTTONS_SHIFT(1)) < 0x10 ? 1 : -1];
+typedef char buttons_p2_check[(BUTTONS_MASK(2) >> BUTTONS_SHIFT(2)) < 0x10 ? 1 : -1];
+
+// Lookup tables from port pins to buttons pressed (see board.h)
+const uint8_t BUTTONS_P1[16] PROGMEM = BOARD_TABLE16(BUTTONS_ENTRY, 1);
+const uint8_t BUTTONS_P2[16] PROGMEM = BOARD_TABLE16(BUTTONS_ENTRY, 2);
+
+// Debounced bitmask of buttons pressed
+volatile uint8_t buttons_state;
+
+// Bitmasks of buttons that were pressed and released since they were taken last time
+volatile uint8_t buttons_pressed;
+volatile uint8_t buttons_released;
+
+#ifdef TELEMETRY
+// millis() of the last debounced press (read with interrupts disabled)
+volatile uint16_t buttons_pressed_ms;
+#endif
+
+// Timer0 at the last raw pin change of buttons (set by pin change ISR)
+volatile uint8_t buttons_phase;
+
+// Vertical counters of samples that differ from debounced state (used by buttons_tick only)
+uint8_t buttons_ct0 = 0xff;
+uint8_t buttons_ct1 = 0xff;
+
+// Interrupt Service Routines for pin changes of buttons take the phase of a human action
+// within a millisecond, that a system tick sample cannot see
+ISR(BOARD_PCINT_vect(1)) {
+	buttons_phase = TCNT0;
+}
+
+ISR(BOARD_PCINT_vect(2)) {
+	buttons_phase = TCNT0;
+}
+
+// Enables pin change interrupts of buttons
+void buttons_init() {
+	BOARD_PCMSK(1) = BUTTONS_MASK(1);
+	BOARD_PCMSK(2) = BUTTONS_MASK(2);
+	MCU_PCIFR = BOARD_PCIE(1) | BOARD_PCIE(2);
+	MCU_PCICR = BOARD_PCIE(1) | BOARD_PCIE(2);
+}
+
+// Returns bitmask of buttons pressed since the last call and clears it
+uint8_t take_pressed_buttons() {
+	uint8_t sreg = SREG;
+	cli();
+	uint8_t mask = buttons_pressed;
+	buttons_pressed = 0;
+	SREG = sreg;
+	return mask;
+}
+
+// Returns bitmask of buttons released since the last call and clears it
+uint8_t take_released_buttons() {
+	uint8_t sreg = SREG;
+	cli();
+	uint8_t mask = buttons_released;
+	buttons_released = 0;
+	SREG = sreg;
+	return mask;
+}
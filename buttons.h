@@ -0,0 +1,116 @@
+/******************************************************************************
+ * Debounced buttons.
+ * Buttons are sampled from the system tick interrupt every DEBOUNCE_TICK_MS
+ * and all of them are filtered in parallel with 2-bit vertical counters,
+ * so a button changes its debounced state only after 4 consecutive samples
+ * that differ from it. Nothing ever blocks waiting for the bounce to end.
+ * Pin change interrupts of buttons only take Timer0 at raw changes for the
+ * entropy pool (and wake CPU up from power-down).
+ *****************************************************************************/
+
+#ifndef BUTTONS_H_
+#define BUTTONS_H_
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include "board.h"
+#include "entropy.h"
+#include "latency.h"
+#include "record.h"
+#include "systick.h"
+
+// Sampling period of buttons (in ms), debounce time is 4 sampling periods
+#define DEBOUNCE_TICK_MS 2
+
+// Debounced bitmask of buttons pressed
+extern volatile uint8_t buttons_state;
+
+// Bitmasks of buttons that were pressed and released since they were taken last time
+extern volatile uint8_t buttons_pressed;
+extern volatile uint8_t buttons_released;
+
+#ifdef TELEMETRY
+// millis() of the last debounced press (read with interrupts disabled)
+extern volatile uint16_t buttons_pressed_ms;
+#endif
+
+// Timer0 at the last raw pin change of buttons (set by pin change ISR)
+extern volatile uint8_t buttons_phase;
+
+// Vertical counters of samples that differ from debounced state (used by buttons_tick only)
+extern uint8_t buttons_ct0;
+extern uint8_t buttons_ct1;
+
+// Lookup tables from port pins to buttons pressed (see board.h)
+extern const uint8_t BUTTONS_P1[16] PROGMEM;
+extern const uint8_t BUTTONS_P2[16] PROGMEM;
+
+// Returns bitmask of buttons pressed right now (without debounce), each port is read once
+static inline uint8_t get_buttons() {
+	return pgm_read_byte(&BUTTONS_P1[(BOARD_PIN(1) >> BUTTONS_SHIFT(1)) & 0x0f]) |
+		pgm_read_byte(&BUTTONS_P2[(BOARD_PIN(2) >> BUTTONS_SHIFT(2)) & 0x0f]);
+}
+
+// Samples buttons and updates debounced state, it is called from system tick ISR
+static inline void buttons_tick() {
+	uint8_t state = buttons_state;
+	uint8_t changed = state ^ get_buttons();
+	// the first sample of a press starts latency measurement
+	if (changed & ~state & buttons_ct0 & buttons_ct1)
+		latency_edge();
+	// count changed buttons, reset counters of others
+	uint8_t ct0 = ~(buttons_ct0 & changed);
+	uint8_t ct1 = ct0 ^ (buttons_ct1 & changed);
+	buttons_ct0 = ct0;
+	buttons_ct1 = ct1;
+	// flip buttons whose counters rolled over
+	changed &= ct0 & ct1;
+	if (changed) {
+		// timing of human press or release within a millisecond and in milliseconds
+		entropy_add(ENTROPY_PHASE, buttons_phase);
+		entropy_add(ENTROPY_MILLIS, (uint8_t)systick_ms);
+		record_edges(changed);
+	}
+	state ^= changed;
+	buttons_state = state;
+#ifdef TELEMETRY
+	if (state & changed)
+		buttons_pressed_ms = systick_ms;
+#endif
+	buttons_pressed |= state & changed;
+	buttons_released |= ~state & changed;
+}
+
+// Enables pin change interrupts of buttons
+extern void buttons_init();
+
+// Returns debounced bitmask of buttons pressed
+static inline uint8_t get_stable_buttons() {
+	return buttons_state;
+}
+
+// Returns true if some button was pressed since pressed buttons were taken last time
+static inline uint8_t has_pressed_buttons() {
+	return buttons_pressed;
+}
+
+#ifdef TELEMETRY
+// Returns millis() of the last debounced press
+static inline uint16_t get_pressed_ms() {
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t ms = buttons_pressed_ms;
+	SREG = sreg;
+	return ms;
+}
+#endif
+
+// Returns bitmask of buttons pressed since the last call and clears it
+extern uint8_t take_pressed_buttons();
+
+// Returns bitmask of buttons released since the last call and clears it
+extern uint8_t take_released_buttons();
+
+#endif /* BUTTONS_H_ */
@@ -5,17 +5,134 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
 
 #include "buzzer.h"
+#include "entropy.h"
+#include "systick.h"
 
 #define sbi(reg, bit)  (reg |= _BV(bit))
 #define cbi(reg, bit)  (reg &= ~_BV(bit))
 
+// Queued note, values are prepared by start_buzzer for the specific timer
+typedef struct {
+	uint16_t top; // value for the tone timer top register
+	uint16_t cnt; // number of half periods (timer1) or note length top (timer2)
+	uint8_t frac; // fractional part of tone in 1/256 of a tick (timer1 only)
+#ifdef BUZZER_TIMER2
+	uint8_t cs;   // clock select bits of timer2 (low nibble) and timer1 (high nibble)
+#endif
+} buzzer_note_t;
+
+// Ring buffer of queued notes, written by start_buzzer and read by buzzer ISR
+buzzer_note_t buzzer_queue[BUZZER_QUEUE_SIZE];
+volatile uint8_t buzzer_head; // next note to play (modified by ISR or with interrupts disabled)
+volatile uint8_t buzzer_tail; // next free slot (modified by start_buzzer only)
+
+// Turns buzzer off (also called from ISR when note queue is empty)
+static inline void buzzer_off();
+
+// Loads next note from the queue into hardware, turns buzzer off if the queue is empty
+static inline void buzzer_next();
+
+#ifdef BUZZER_TIMER2
+
+// Prescalers of timer2 and timer1 as powers of 2, indexed by clock select bits - 1
+const uint8_t BUZZER_SHIFT2[7] PROGMEM = { 0, 3, 5, 6, 7, 8, 10 }; // 1, 8, 32, 64, 128, 256, 1024
+const uint8_t BUZZER_SHIFT1[5] PROGMEM = { 0, 3, 6, 8, 10 };       // 1, 8, 64, 256, 1024
+
+// Interrupt Service Routine for the end of the note (timer2 toggles buzzer pin by itself)
+ISR(TIMER1_COMPA_vect) {
+	buzzer_next();
+}
+
+// Prepares queued note for timer2 tone and timer1 note length (periods are top + 1),
+// each timer gets the smallest prescaler that fits, tone and length are rounded to it
+static inline void buzzer_prepare(buzzer_note_t *note, uint16_t tone, uint16_t cnt) {
+	uint8_t cs2 = 1;
+	uint8_t shift = 0;
+	while (cs2 < 7 && ((tone + (1 << shift >> 1)) >> shift) > 0x100)
+		shift = pgm_read_byte(&BUZZER_SHIFT2[cs2++]);
+	note->top = ((tone + (1 << shift >> 1)) >> shift) - 1;
+	uint32_t len = (uint32_t)tone * cnt; // in clock cycles
+	uint8_t cs1 = 1;
+	shift = 0;
+	while (cs1 < 5 && ((len + (1UL << shift >> 1)) >> shift) > 0x10000)
+		shift = pgm_read_byte(&BUZZER_SHIFT1[cs1++]);
+	len = (len + (1UL << shift >> 1)) >> shift;
+	note->cnt = len > 0x10000 ? 0xffff : len - 1;
+	note->cs = cs2 | (cs1 << 4);
+}
+
+// Loads next note from the queue into hardware, turns buzzer off if the queue is empty
+static inline void buzzer_next() {
+	uint8_t head = buzzer_head;
+	if (head == buzzer_tail) {
+		buzzer_off();
+		return;
+	}
+	buzzer_note_t *note = &buzzer_queue[head];
+	// CTC compare registers are not buffered, so restart the period if it is already past new top
+	uint8_t cs = note->cs;
+	TCCR2B = cs & 0x0f;                 // set prescaler of tone
+	uint8_t top = note->top;
+	OCR2A = top;                        // set top to tone (half period of sound wave)
+	if (TCNT2 > top)
+		TCNT2 = 0;
+	TCCR1B = _BV(WGM12) | (cs >> 4);    // set prescaler of note length
+	uint16_t len = note->cnt;
+	OCR1A = len;                        // set top to note length
+	if (TCNT1 > len)
+		TCNT1 = 0;
+	buzzer_head = (head + 1) & (BUZZER_QUEUE_SIZE - 1);
+}
+
+// Starts timers for the first note in the queue
+static inline void buzzer_on() {
+	clock_full();                       // tones are computed for full clock
+	// stop both prescalers while timers are configured
+	GTCCR = _BV(TSM) | _BV(PSRASY) | _BV(PSRSYNC);
+	// use timer2 in CTC mode with toggle of OC2B on compare match for tone
+	TCCR2A = _BV(COM2B0) | _BV(WGM21);
+	// use timer1 in CTC mode for note length (prescalers are set with the note)
+	TCCR1A = 0;
+	// reset timer counters to zero
+	TCNT2 = 0;
+	TCNT1 = 0;
+	// set the other buzzer pin low
+	cbi(BUZZER_PORT2, BUZZER_BIT2);
+	buzzer_next();                      // load first note
+	sbi(TIFR1, OCF1A);                  // clear pending compare interrupt flag
+	sbi(TIMSK1, OCIE1A);                // enable compare interrupt
+	GTCCR = 0;                          // start prescalers
+}
+
+// Turns buzzer off (also called from ISR when note queue is empty)
+static inline void buzzer_off() {
+	// disable compare interrupt and stop note length timer
+	cbi(TIMSK1, OCIE1A);
+	TCCR1B = 0;
+	// disconnect OC2B from the buzzer pin and return timer2 to normal mode, so that it
+	// keeps counting 0..255 at 1:256 for random (see hal_init)
+	TCCR2A = 0;
+	TCCR2B = _BV(CS22) | _BV(CS21);
+	// set both buzzer pins low so that it does not consume power
+	cbi(BUZZER_PORT1, BUZZER_BIT1);
+	cbi(BUZZER_PORT2, BUZZER_BIT2);
+	entropy_mix(TCNT0);                 // nearly deterministic, so it is not credited
+	clock_idle();                       // nothing needs full clock now
+}
+
+#else /* BUZZER_TIMER2 */
+
 // Remaining number of half periods for buzzer time1 ISR
 volatile uint16_t buzzer_count;
 
-// Current buzzer callback routine (call it when done)
-volatile buzzer_callback_t buzzer_done_callback;
+// Top of the current tone, its fractional part, and fractional accumulator for buzzer time1 ISR
+uint16_t buzzer_top;
+uint8_t buzzer_frac;
+uint8_t buzzer_acc;
 
 // Interrupt Service Routine for timer overflow to flip buzzer
 ISR(TIMER1_OVF_vect) {
@@ -25,43 +142,144 @@ ISR(TIMER1_OVF_vect) {
 	// decrement remaining counter
 	uint16_t remaining = buzzer_count - 1;
 	buzzer_count = remaining;
-	// invoke callback when done
-	if (remaining == 0)
-		(*buzzer_done_callback)();
-}
-
-// Starts buzzer with a specified tone, counter of half-periods, and callback when done
-// You can start_buzzer again in callback to play next tone or stop_buzzer to finish
-void start_buzzer(uint16_t tone, uint16_t cnt, buzzer_callback_t done_callback) {
-	if (!is_buzzer_working()) {
-		// use timer1 in Fast PWM mode 15 for buzzer, no prescaler
-		TCCR1A = _BV(WGM11) | _BV(WGM10);
-		TCCR1B = _BV(WGM13) | _BV(WGM12) | _BV(CS10);
-		// reset timer counter to zero
-		TCNT1 = 0;
-		// set one buzzer pin low and the other high
-		cbi(BUZZER_PORT1, BUZZER_BIT1);
-		sbi(BUZZER_PORT2, BUZZER_BIT2);
+	// take next note from the queue when done
+	if (remaining == 0) {
+		buzzer_next();
+		return;
+	}
+	// fractional-N: a half period is one tick longer whenever accumulator overflows,
+	// OCR1A is double-buffered, so each value is used for exactly one whole half period
+	uint8_t frac = buzzer_frac;
+	if (frac != 0) {
+		uint8_t acc = buzzer_acc + frac;
+		uint16_t top = buzzer_top;
+		if (acc < frac)
+			top++;
+		buzzer_acc = acc;
+		OCR1A = top;
 	}
-	cbi(TIMSK1, TOIE1);                   // disable overflow interrupt
-	OCR1A = tone;                         // set top to tone (half period of sound wave)
-	buzzer_count = cnt;                   // set count of half periods
-	buzzer_done_callback = done_callback; // set callback
-	sbi(TIFR1, TOV1);                     // clear pending overflow interrupt flag
-	sbi(TIMSK1, TOIE1);                   // enable overflow interrupt
 }
 
-// Stops buzzer
-void stop_buzzer() {
+// Prepares queued note for timer1 (period is top + 1)
+static inline void buzzer_prepare(buzzer_note_t *note, uint16_t tone, uint16_t cnt) {
+	note->top = tone - 1;
+	note->cnt = cnt;
+}
+
+// Loads next note from the queue into hardware, turns buzzer off if the queue is empty
+static inline void buzzer_next() {
+	uint8_t head = buzzer_head;
+	if (head == buzzer_tail) {
+		buzzer_off();
+		return;
+	}
+	buzzer_note_t *note = &buzzer_queue[head];
+	uint16_t top = note->top;
+	OCR1A = top;                        // set top to tone (double-buffered, so phase is continuous)
+	buzzer_top = top;
+	buzzer_frac = note->frac;           // set fractional part of tone
+	buzzer_count = note->cnt;           // set count of half periods
+	buzzer_head = (head + 1) & (BUZZER_QUEUE_SIZE - 1);
+}
+
+// Starts timer for the first note in the queue
+static inline void buzzer_on() {
+	clock_full();                       // tones are computed for full clock
+	// stop timer1 in normal mode, where OCR1A is not double-buffered, so that the first
+	// half period is the first note already, not the top that was left from the last one
+	TCCR1B = 0;
+	TCCR1A = 0;
+	// reset timer counter to zero
+	TCNT1 = 0;
+	// set one buzzer pin low and the other high
+	cbi(BUZZER_PORT1, BUZZER_BIT1);
+	sbi(BUZZER_PORT2, BUZZER_BIT2);
+	buzzer_next();                      // load first note
+	// use timer1 in Fast PWM mode 15 for buzzer, no prescaler
+	TCCR1A = _BV(WGM11) | _BV(WGM10);
+	TCCR1B = _BV(WGM13) | _BV(WGM12) | _BV(CS10);
+	sbi(TIFR1, TOV1);                   // clear pending overflow interrupt flag
+	sbi(TIMSK1, TOIE1);                 // enable overflow interrupt
+}
+
+// Turns buzzer off (also called from ISR when note queue is empty)
+static inline void buzzer_off() {
 	// disable overflow interrupt
 	cbi(TIMSK1, TOIE1);
 	// set both buzzer pins low so that it does not consume power
 	cbi(BUZZER_PORT1, BUZZER_BIT1);
 	cbi(BUZZER_PORT2, BUZZER_BIT2);
+	entropy_mix(TCNT0);                 // nearly deterministic, so it is not credited
+	clock_idle();                       // nothing needs full clock now
+}
+
+#endif /* BUZZER_TIMER2 */
+
+// Enqueues a tone (with 1/256 fractional part) with a specified counter of half-periods
+// and starts buzzer if it is not working
+// Returns zero without blocking when the note queue is full
+uint8_t start_buzzer(uint16_t tone, uint8_t frac, uint16_t cnt) {
+	uint8_t tail = buzzer_tail;
+	uint8_t next = (tail + 1) & (BUZZER_QUEUE_SIZE - 1);
+	if (next == buzzer_head)
+		return 0; // queue is full
+	buzzer_prepare(&buzzer_queue[tail], tone, cnt);
+	buzzer_queue[tail].frac = frac;
+	// publish note and start buzzer atomically, so that ISR cannot stop in between
+	uint8_t sreg = SREG;
+	cli();
+	buzzer_tail = next;
+	if (!is_buzzer_working())
+		buzzer_on();
+	SREG = sreg;
+	return 1;
+}
+
+// Stops buzzer and discards all queued notes
+void stop_buzzer() {
+	uint8_t sreg = SREG;
+	cli();
+	buzzer_off();
+	buzzer_head = buzzer_tail;
+	SREG = sreg;
+}
+
+// Sleeps in idle mode until the next interrupt, must be called with interrupts disabled
+// (SEI executes the next instruction before any interrupt, so it cannot be missed before SLEEP)
+static inline void buzzer_sleep() {
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+	cli();
+}
+
+// Enqueues a tone with a specified counter of half-periods, sleeping while the note queue is full
+void queue_buzzer(uint16_t tone, uint8_t frac, uint16_t cnt) {
+	uint8_t sreg = SREG;
+	cli();
+	while (!start_buzzer(tone, frac, cnt))
+		buzzer_sleep();
+	SREG = sreg;
+}
+
+// Waits until all queued notes are played, sleeping between buzzer interrupts
+void wait_buzzer() {
+	uint8_t sreg = SREG;
+	cli();
+	while (is_buzzer_working())
+		buzzer_sleep();
+	SREG = sreg;
+}
+
+// Enqueues a tone with a specified counter of half-periods, and waits until all queued notes finish
+void buzzer_wait(uint16_t tone, uint8_t frac, uint16_t cnt) {
+	queue_buzzer(tone, frac, cnt);
+	wait_buzzer();
 }
 
-// Starts buzzer with a specified tone and counter of half-periods, and waits until it finishes
-void buzzer_wait(uint16_t tone, uint16_t cnt) {
-	start_buzzer(tone, cnt, &stop_buzzer);
-	while (is_buzzer_working());
+// Same as start_buzzer with tone, frac, cnt triple read from flash (PROGMEM table of FREQLEN2TONECNT)
+uint8_t start_buzzer_P(const uint16_t *tonecnt) {
+	return start_buzzer(pgm_read_word(tonecnt), pgm_read_word(tonecnt + 1), pgm_read_word(tonecnt + 2));
 }
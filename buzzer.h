@@ -2,7 +2,27 @@
  * Interrupt-driven code for playing tones with piezoelectric buzzer.
  * This code uses 16-bit Timer1 AVR hardware for precise frequency control
  * and is completely interrupt driven. One tone can be changed to the next one
- * seamlessly without any shift in phase.
+ * seamlessly without any shift in phase. Notes are queued into a fixed-size
+ * ring buffer that is consumed directly by the interrupt service routine,
+ * so whole melodies can be enqueued ahead of time. Its ISR takes about 90
+ * cycles per half period (100 with a fractional tone), about the same as the
+ * callback chain it replaced (89 cycles, it saved all 12 call-clobbered
+ * registers for the call through a pointer), but the next note starts right
+ * in the ISR instead of a callback (see sim_cycles in host/sim.c, estimated
+ * without an AVR listing; test_buzzer reports the cycles per note).
+ * Define BUZZER_TIMER2 during compilation to use 8-bit Timer2 in CTC mode
+ * instead. It toggles OC2B (BUZZER_BIT1) in hardware, while Timer1 only
+ * measures note length, so there is one interrupt per note instead of one
+ * per half period. Only one leg of the buzzer is driven in this mode.
+ * Each note gets the smallest Timer2 prescaler that fits its half period
+ * into 8 bits and the smallest Timer1 prescaler that fits its length into
+ * 16 bits, so both are rounded to a multiple of their prescaler. Game tones
+ * and note lengths stay within 0.5% at 1, 8, 12, 16 and 20 MHz; the winner
+ * sweep is within 0.8% (at 12 MHz and above its longest half periods need
+ * prescaler 32). make test verifies it for every backend on the simulator.
+ * Tones have an 8-bit fractional part. The default Timer1 backend alternates
+ * half periods of tone and tone + 1 ticks with a fractional accumulator, so
+ * that the average frequency is exact; the other backends ignore it.
  * (C) Roman Elizarov, 2010
  *****************************************************************************/
 
@@ -11,41 +31,71 @@
 
 #include <avr/io.h>
 
-// Defines physical connection on the buzzer
-#define BUZZER_PORT1 PORTD
-#define BUZZER_PIN1  PIND
-#define BUZZER_BIT1  3
-#define BUZZER_PORT2 PORTD
-#define BUZZER_PIN2  PIND
-#define BUZZER_BIT2  4
+#include "board.h" // defines physical connection of the buzzer
 
-// Converts frequency (in HZ) into tone value for start_buzzer
-#define FREQ2TONE(freq)             ((uint16_t)(F_CPU / (freq) / 2))
+// Timing model: tone is a half period of sound wave in CPU clock cycles for all backends,
+// everything is derived from the frequency of these cycles (in HZ)
+#define BUZZER_CLOCK                F_CPU
 
-// Converts tone and length (in ms) into cnt value for start_buzzer
-#define TONELEN2CNT(tone, len)      ((uint16_t)(((uint32_t)1000 * (len)) / (tone)))
+#ifdef BUZZER_TIMER2
+// Converts frequency (in HZ) into tone value for start_buzzer (compile-time constants only)
+#define FREQ2TONE(freq)             ((uint16_t)(BUZZER_CLOCK / 2.0 / (freq) + 0.5))
+
+// Converts frequency (in HZ) into fractional part of tone value (not supported by this backend)
+#define FREQ2FRAC(freq)             0
+#else
+// Converts frequency (in HZ) into tone value with 8 fractional bits (compile-time constants only)
+#define FREQ2TONE_FP8(freq)         ((uint32_t)(BUZZER_CLOCK * 128.0 / (freq) + 0.5))
+
+// Converts frequency (in HZ) into tone value for start_buzzer (compile-time constants only)
+#define FREQ2TONE(freq)             ((uint16_t)(FREQ2TONE_FP8(freq) >> 8))
+
+// Converts frequency (in HZ) into fractional part of tone value for start_buzzer
+#define FREQ2FRAC(freq)             ((uint8_t)FREQ2TONE_FP8(freq))
+#endif
+
+// Fixed-point (8 fractional bits) number of clock cycles per microsecond
+#define BUZZER_TICKS_PER_US_FP8     ((uint32_t)(BUZZER_CLOCK * 256.0 / 1000000 + 0.5))
+
+// Converts half period (in us) into tone value for start_buzzer (cheap at run-time)
+#define US2TONE(us)                 ((uint16_t)(((uint32_t)(us) * BUZZER_TICKS_PER_US_FP8) >> 8))
 
 // Converts frequency (in HZ) and length (in ms) into cnt value for start_buzzer
-#define FREQLEN2CNT(freq, len)      TONELEN2CNT(FREQ2TONE(freq), len)
+#define FREQLEN2CNT(freq, len)      ((uint16_t)((freq) * (len) / 500.0 + 0.5))
 
-// Converts frequency (in HZ) and length (in ms) into tone, cnt pair for start_buzzer
-#define FREQLEN2TONECNT(freq, len)  FREQ2TONE(freq), FREQLEN2CNT(freq, len)
+// Converts frequency (in HZ) and length (in ms) into tone, frac, cnt triple for start_buzzer
+#define FREQLEN2TONECNT(freq, len)  FREQ2TONE(freq), FREQ2FRAC(freq), FREQLEN2CNT(freq, len)
 
-typedef void (*buzzer_callback_t)();
+// Size of the note queue (must be a power of 2)
+#define BUZZER_QUEUE_SIZE 16
 
 // Returns true when buzzer is working
-inline uint8_t is_buzzer_working() {
+static inline uint8_t is_buzzer_working() {
+#ifdef BUZZER_TIMER2
+	return TIMSK1 & _BV(OCIE1A);
+#else
 	return TIMSK1 & _BV(TOIE1);
+#endif
 }
 
-// Starts buzzer with a specified tone, counter of half-periods, and callback when done
-// You can start_buzzer again in callback to play next tone or stop_buzzer to finish
-extern void start_buzzer(uint16_t tone, uint16_t cnt, buzzer_callback_t done_callback);
+// Enqueues a tone (with 1/256 fractional part) with a specified counter of half-periods
+// and starts buzzer if it is not working
+// Returns zero without blocking when the note queue is full
+extern uint8_t start_buzzer(uint16_t tone, uint8_t frac, uint16_t cnt);
 
-// Stops buzzer
+// Stops buzzer and discards all queued notes
 extern void stop_buzzer();
 
-// Starts buzzer with a specified tone and counter of half-periods, and waits until it finishes
-extern void buzzer_wait(uint16_t tone, uint16_t cnt);
+// Enqueues a tone with a specified counter of half-periods, sleeping while the note queue is full
+extern void queue_buzzer(uint16_t tone, uint8_t frac, uint16_t cnt);
+
+// Waits until all queued notes are played, sleeping between buzzer interrupts
+extern void wait_buzzer();
+
+// Enqueues a tone with a specified counter of half-periods, and waits until all queued notes finish
+extern void buzzer_wait(uint16_t tone, uint8_t frac, uint16_t cnt);
+
+// Same as start_buzzer with tone, frac, cnt triple read from flash (PROGMEM table of FREQLEN2TONECNT)
+extern uint8_t start_buzzer_P(const uint16_t *tonecnt);
 
 #endif /* BUZZER_H_ */
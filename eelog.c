@@ -0,0 +1,105 @@
+/******************************************************************************
+ * Wear-leveled log of game settings in EEPROM.
+ *****************************************************************************/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+
+#include "eelog.h"
+
+// Size of one record in EEPROM
+#define EELOG_RECORD_SIZE sizeof(eelog_record_t)
+
+// The ring must fit into EEPROM
+typedef char eelog_size_check[EELOG_BASE + EELOG_RECORDS * EELOG_RECORD_SIZE <= E2END + 1 ? 1 : -1];
+
+// Record being written by ISR and the one saved after it was started
+eelog_record_t eelog_active;
+eelog_record_t eelog_pending;
+volatile uint8_t eelog_has_pending;
+
+// Next byte of active record to write (EELOG_RECORD_SIZE when it is complete)
+uint8_t eelog_byte = EELOG_RECORD_SIZE;
+
+// Slot and sequence number for the next record
+uint8_t eelog_slot;
+uint8_t eelog_seq;
+
+// Number of bytes written into EEPROM since startup (to measure wear)
+volatile uint16_t eelog_writes;
+
+// Returns check byte of a record
+static inline uint8_t eelog_check(eelog_record_t *rec) {
+	return rec->seq ^ rec->level ^ rec->best ^ 0xa5; // erased 0xff record is never valid
+}
+
+// Returns EEPROM address of a slot
+static inline uint16_t eelog_addr(uint8_t slot) {
+	return EELOG_BASE + slot * EELOG_RECORD_SIZE;
+}
+
+// Interrupt Service Routine for EEPROM ready to write the next byte
+ISR(EE_READY_vect) {
+	uint8_t i = eelog_byte;
+	if (i == EELOG_RECORD_SIZE) {
+		// active record is complete, start the pending one if there is any
+		if (!eelog_has_pending) {
+			EECR &= ~_BV(EERIE);
+			return;
+		}
+		eelog_active = eelog_pending;
+		eelog_has_pending = 0;
+		eelog_active.seq = eelog_seq++;
+		eelog_active.check = eelog_check(&eelog_active);
+		i = 0;
+	}
+	EEAR = eelog_addr(eelog_slot) + i;
+	EEDR = ((uint8_t *)&eelog_active)[i];
+	EECR |= _BV(EEMPE);
+	EECR |= _BV(EEPE); // must be within 4 cycles after EEMPE
+	eelog_writes++;
+	if (++i == EELOG_RECORD_SIZE)
+		eelog_slot = eelog_slot == EELOG_RECORDS - 1 ? 0 : eelog_slot + 1;
+	eelog_byte = i;
+}
+
+// Reads record from a slot, returns true if it is valid
+static uint8_t eelog_read(uint8_t slot, eelog_record_t *rec) {
+	const uint8_t *addr = (const uint8_t *)(uintptr_t)eelog_addr(slot);
+	uint8_t i;
+	for (i = 0; i < EELOG_RECORD_SIZE; i++)
+		((uint8_t *)rec)[i] = eeprom_read_byte(addr + i);
+	return rec->check == eelog_check(rec);
+}
+
+// Finds the newest record, returns zero if there is none
+// The newest record is the valid one that is not followed by its successor
+uint8_t eelog_init(eelog_record_t *rec) {
+	eelog_record_t next;
+	uint8_t slot;
+	uint8_t valid;
+	uint8_t next_valid = eelog_read(0, &next);
+	for (slot = 0; slot < EELOG_RECORDS; slot++) {
+		*rec = next;
+		valid = next_valid;
+		next_valid = eelog_read(slot == EELOG_RECORDS - 1 ? 0 : slot + 1, &next);
+		if (valid && !(next_valid && next.seq == (uint8_t)(rec->seq + 1))) {
+			eelog_slot = slot == EELOG_RECORDS - 1 ? 0 : slot + 1;
+			eelog_seq = rec->seq + 1;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Saves level and high score in background
+void eelog_save(uint8_t level, uint8_t best) {
+	uint8_t sreg = SREG;
+	cli();
+	eelog_pending.level = level;
+	eelog_pending.best = best;
+	eelog_has_pending = 1;
+	EECR |= _BV(EERIE); // ISR starts it as soon as EEPROM is ready
+	SREG = sreg;
+}
@@ -0,0 +1,45 @@
+/******************************************************************************
+ * Wear-leveled log of game settings in EEPROM.
+ * Each save appends a small record to a ring of EELOG_RECORDS slots, so
+ * every EEPROM cell is rewritten only once per EELOG_RECORDS saves: with
+ * 100000 rated write cycles and one save per game it lasts for 6.4 million
+ * games. Records carry an 8-bit sequence number and a check byte that is
+ * written last, so a record torn by power loss is ignored. The newest record
+ * is found at startup by a single pass over the ring.
+ * Saves never block: the record is written behind by EEPROM ready interrupt
+ * one byte (3.4ms) at a time. Only the latest of several saves that are
+ * made while a record is being written is kept.
+ *****************************************************************************/
+
+#ifndef EELOG_H_
+#define EELOG_H_
+
+#include <avr/io.h>
+
+// Location of the ring in EEPROM and number of records in it
+#define EELOG_BASE    0
+#define EELOG_RECORDS 64
+
+// Logged record
+typedef struct {
+	uint8_t seq;   // sequence number (assigned by eelog)
+	uint8_t level; // game level
+	uint8_t best;  // high score (longest sequence repeated)
+	uint8_t check; // check byte (assigned by eelog)
+} eelog_record_t;
+
+// Number of bytes written into EEPROM since startup (to measure wear)
+extern volatile uint16_t eelog_writes;
+
+// Finds the newest record, returns zero if there is none
+extern uint8_t eelog_init(eelog_record_t *rec);
+
+// Saves level and high score in background
+extern void eelog_save(uint8_t level, uint8_t best);
+
+// Returns true while a record is being written
+static inline uint8_t is_eelog_busy() {
+	return EECR & _BV(EERIE);
+}
+
+#endif /* EELOG_H_ */
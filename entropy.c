@@ -0,0 +1,25 @@
+/******************************************************************************
+ * Entropy pool fed by the timing of human actions.
+ *****************************************************************************/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "entropy.h"
+
+// Entropy pool (modified by ISRs or with interrupts disabled)
+volatile uint16_t entropy_pool;
+
+// The last sample of each credited source and estimated number of entropy bits in the pool
+volatile uint8_t entropy_last[ENTROPY_SOURCES];
+volatile uint8_t entropy_bits;
+
+// Returns the pool and resets its health estimate (the pool itself keeps mixing)
+uint16_t take_entropy() {
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t pool = entropy_pool;
+	entropy_bits = 0;
+	SREG = sreg;
+	return pool;
+}
@@ -0,0 +1,62 @@
+/******************************************************************************
+ * Entropy pool fed by the timing of human actions.
+ * Every debounced button edge mixes two samples into the pool: Timer0 at
+ * the last raw pin change of buttons (phase within a millisecond, taken by
+ * pin change interrupt) and millis() of the edge. Buzzer stop mixes Timer0,
+ * too, but it is nearly deterministic and is never credited. Mixing is XOR
+ * and a 16-bit xorshift step, cheap enough for ISRs, and as the step is a
+ * bijection, samples that overlap in bits do not cancel each other. Health
+ * of the pool is estimated conservatively as one bit per sample that differs
+ * from the previous one of the same source (stuck sources are not credited),
+ * up to the pool size.
+ *****************************************************************************/
+
+#ifndef ENTROPY_H_
+#define ENTROPY_H_
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+// Size of the pool in bits
+#define ENTROPY_POOL_BITS 16
+
+// Entropy pool (modified by ISRs or with interrupts disabled)
+extern volatile uint16_t entropy_pool;
+
+// Credited sources of samples
+#define ENTROPY_PHASE   0 // Timer0 at the last raw pin change of buttons
+#define ENTROPY_MILLIS  1 // millis() at debounced button edge
+#define ENTROPY_SOURCES 2
+
+// The last sample of each credited source and estimated number of entropy bits in the pool
+extern volatile uint8_t entropy_last[ENTROPY_SOURCES];
+extern volatile uint8_t entropy_bits;
+
+// Mixes a sample into the pool without credit, it must be called with interrupts disabled
+static inline void entropy_mix(uint8_t sample) {
+	uint16_t pool = entropy_pool ^ sample;
+	pool ^= pool << 7;
+	pool ^= pool >> 9;
+	pool ^= pool << 8;
+	entropy_pool = pool;
+}
+
+// Mixes a sample of a credited source into the pool, it must be called with interrupts disabled
+static inline void entropy_add(uint8_t source, uint8_t sample) {
+	entropy_mix(sample);
+	if (sample != entropy_last[source]) {
+		entropy_last[source] = sample;
+		if (entropy_bits < ENTROPY_POOL_BITS)
+			entropy_bits++;
+	}
+}
+
+// Returns estimated number of entropy bits in the pool (0..ENTROPY_POOL_BITS)
+static inline uint8_t entropy_health() {
+	return entropy_bits;
+}
+
+// Returns the pool and resets its health estimate (the pool itself keeps mixing)
+extern uint16_t take_entropy();
+
+#endif /* ENTROPY_H_ */
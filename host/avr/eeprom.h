@@ -0,0 +1,15 @@
+/******************************************************************************
+ * Host shim of <avr/eeprom.h> for the simulator (see host/sim.h).
+ * EEPROM contents are sim_eeprom in host/sim.c.
+ *****************************************************************************/
+
+#ifndef HOST_AVR_EEPROM_H_
+#define HOST_AVR_EEPROM_H_
+
+#include <stdint.h>
+
+#define EEMEM
+
+extern uint8_t eeprom_read_byte(const uint8_t *addr);
+
+#endif /* HOST_AVR_EEPROM_H_ */
@@ -0,0 +1,25 @@
+/******************************************************************************
+ * Host shim of <avr/interrupt.h> for the simulator (see host/sim.h).
+ * An ISR is a plain function named after its vector, so the simulator calls
+ * it directly when the interrupt fires. Interrupts are never nested and
+ * firmware code does not advance virtual time (its cycles are only charged,
+ * see sim_cycles), so sei() and cli() do nothing.
+ *****************************************************************************/
+
+#ifndef HOST_AVR_INTERRUPT_H_
+#define HOST_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define ISR(vector, ...)       void vector(void); void vector(void)
+#define EMPTY_INTERRUPT(vector) void vector(void); void vector(void) {}
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define ISR_NAKED
+#define ISR_ALIASOF(vector)
+
+#define sei()
+#define cli()
+#define reti()
+
+#endif /* HOST_AVR_INTERRUPT_H_ */
@@ -0,0 +1,197 @@
+/******************************************************************************
+ * Host shim of <avr/io.h> for the simulator (see host/sim.h).
+ * It models ATmega168: every I/O register used by the firmware is a plain
+ * variable defined in host/sim.c, and bit numbers are the ones of avr-libc,
+ * so firmware sources compile with the host compiler unchanged.
+ *****************************************************************************/
+
+#ifndef HOST_AVR_IO_H_
+#define HOST_AVR_IO_H_
+
+#include <stdint.h>
+
+#ifndef __AVR_ATmega168__
+#define __AVR_ATmega168__ 1
+#endif
+
+#define _BV(bit)          (1 << (bit))
+#define _SFR_IO_ADDR(reg) 0
+
+#define RAMEND 0x4ff
+#define E2END  0x1ff
+
+// I/O registers (defined in host/sim.c)
+#define HOST_REG8(name)  extern volatile uint8_t name;
+#define HOST_REG16(name) extern volatile uint16_t name;
+
+HOST_REG8(SREG)
+HOST_REG8(PINB)  HOST_REG8(DDRB)  HOST_REG8(PORTB)
+HOST_REG8(PINC)  HOST_REG8(DDRC)  HOST_REG8(PORTC)
+HOST_REG8(PIND)  HOST_REG8(DDRD)  HOST_REG8(PORTD)
+HOST_REG8(TIFR0) HOST_REG8(TIFR1) HOST_REG8(TIFR2) HOST_REG8(PCIFR)
+HOST_REG8(EECR)  HOST_REG8(EEDR)  HOST_REG16(EEAR)
+HOST_REG8(GTCCR)
+HOST_REG8(TCCR0A) HOST_REG8(TCCR0B) HOST_REG8(TCNT0) HOST_REG8(OCR0A) HOST_REG8(OCR0B)
+HOST_REG8(SMCR)  HOST_REG8(MCUCR) HOST_REG8(ACSR)
+HOST_REG8(CLKPR) HOST_REG8(PRR)
+HOST_REG8(PCICR) HOST_REG8(PCMSK0) HOST_REG8(PCMSK1) HOST_REG8(PCMSK2)
+HOST_REG8(TIMSK0) HOST_REG8(TIMSK1) HOST_REG8(TIMSK2)
+HOST_REG8(ADCSRA)
+HOST_REG8(TCCR1A) HOST_REG8(TCCR1B) HOST_REG8(TCCR1C)
+HOST_REG16(TCNT1) HOST_REG16(OCR1A) HOST_REG16(OCR1B)
+HOST_REG8(TCCR2A) HOST_REG8(TCCR2B) HOST_REG8(TCNT2) HOST_REG8(OCR2A) HOST_REG8(OCR2B)
+HOST_REG8(ASSR)
+HOST_REG8(UCSR0A) HOST_REG8(UCSR0B) HOST_REG8(UCSR0C) HOST_REG16(UBRR0) HOST_REG8(UDR0)
+
+// Port pins
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+// Timer0
+#define WGM00  0
+#define WGM01  1
+#define WGM02  3
+#define CS00   0
+#define CS01   1
+#define CS02   2
+#define TOIE0  0
+#define OCIE0A 1
+#define OCIE0B 2
+#define TOV0   0
+#define OCF0A  1
+#define OCF0B  2
+
+// Timer1
+#define WGM10  0
+#define WGM11  1
+#define COM1B0 4
+#define COM1B1 5
+#define COM1A0 6
+#define COM1A1 7
+#define CS10   0
+#define CS11   1
+#define CS12   2
+#define WGM12  3
+#define WGM13  4
+#define TOIE1  0
+#define OCIE1A 1
+#define OCIE1B 2
+#define TOV1   0
+#define OCF1A  1
+#define OCF1B  2
+
+// Timer2
+#define WGM20  0
+#define WGM21  1
+#define COM2B0 4
+#define COM2B1 5
+#define COM2A0 6
+#define COM2A1 7
+#define CS20   0
+#define CS21   1
+#define CS22   2
+#define WGM22  3
+#define TOIE2  0
+#define OCIE2A 1
+#define OCIE2B 2
+#define TOV2   0
+#define OCF2A  1
+#define OCF2B  2
+
+// General timer/counter control
+#define PSRSYNC 0
+#define PSRASY  1
+#define TSM     7
+
+// Pin change interrupts
+#define PCIE0  0
+#define PCIE1  1
+#define PCIE2  2
+#define PCIF0  0
+#define PCIF1  1
+#define PCIF2  2
+#define PCINT0  0
+#define PCINT1  1
+#define PCINT2  2
+#define PCINT3  3
+#define PCINT4  4
+#define PCINT5  5
+#define PCINT6  6
+#define PCINT7  7
+#define PCINT8  0
+#define PCINT9  1
+#define PCINT10 2
+#define PCINT11 3
+#define PCINT12 4
+#define PCINT13 5
+#define PCINT14 6
+#define PCINT15 7
+#define PCINT16 0
+#define PCINT17 1
+#define PCINT18 2
+#define PCINT19 3
+#define PCINT20 4
+#define PCINT21 5
+#define PCINT22 6
+#define PCINT23 7
+
+// Sleep, power reduction and clock prescaler
+#define SE     0
+#define SM0    1
+#define SM1    2
+#define SM2    3
+#define PRADC    0
+#define PRUSART0 1
+#define PRSPI    2
+#define PRTIM1   3
+#define PRTIM0   5
+#define PRTIM2   6
+#define PRTWI    7
+#define CLKPS0 0
+#define CLKPCE 7
+
+// Analog comparator and ADC
+#define ACD    7
+#define ADEN   7
+
+// USART0
+#define MPCM0  0
+#define U2X0   1
+#define UPE0   2
+#define DOR0   3
+#define FE0    4
+#define UDRE0  5
+#define TXC0   6
+#define RXC0   7
+#define TXB80  0
+#define RXB80  1
+#define UCSZ02 2
+#define TXEN0  3
+#define RXEN0  4
+#define UDRIE0 5
+#define TXCIE0 6
+#define RXCIE0 7
+#define UCSZ00 1
+#define UCSZ01 2
+
+// EEPROM
+#define EERE   0
+#define EEPE   1
+#define EEMPE  2
+#define EERIE  3
+
+#endif /* HOST_AVR_IO_H_ */
@@ -0,0 +1,16 @@
+/******************************************************************************
+ * Host shim of <avr/pgmspace.h> for the simulator (see host/sim.h).
+ * There is a single address space on the host, so flash is plain memory.
+ *****************************************************************************/
+
+#ifndef HOST_AVR_PGMSPACE_H_
+#define HOST_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(s)               (s)
+#define pgm_read_byte(addr)   (*(const uint8_t *)(addr))
+#define pgm_read_word(addr)   (*(const uint16_t *)(addr))
+
+#endif /* HOST_AVR_PGMSPACE_H_ */
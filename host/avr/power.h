@@ -0,0 +1,26 @@
+/******************************************************************************
+ * Host shim of <avr/power.h> for the simulator (see host/sim.h).
+ * Clock prescaler is written straight into CLKPR, so that the simulator
+ * scales time of every timer by it.
+ *****************************************************************************/
+
+#ifndef HOST_AVR_POWER_H_
+#define HOST_AVR_POWER_H_
+
+#include <avr/io.h>
+
+typedef enum {
+	clock_div_1 = 0,
+	clock_div_2 = 1,
+	clock_div_4 = 2,
+	clock_div_8 = 3,
+	clock_div_16 = 4,
+	clock_div_32 = 5,
+	clock_div_64 = 6,
+	clock_div_128 = 7,
+	clock_div_256 = 8
+} clock_div_t;
+
+#define clock_prescale_set(div) (CLKPR = (div))
+
+#endif /* HOST_AVR_POWER_H_ */
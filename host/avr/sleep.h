@@ -0,0 +1,23 @@
+/******************************************************************************
+ * Host shim of <avr/sleep.h> for the simulator (see host/sim.h).
+ * sleep_cpu() advances virtual time to the next interrupt and runs it.
+ *****************************************************************************/
+
+#ifndef HOST_AVR_SLEEP_H_
+#define HOST_AVR_SLEEP_H_
+
+#include <avr/io.h>
+
+#define SLEEP_MODE_IDLE      0
+#define SLEEP_MODE_ADC       _BV(SM0)
+#define SLEEP_MODE_PWR_DOWN  _BV(SM1)
+#define SLEEP_MODE_PWR_SAVE  (_BV(SM0) | _BV(SM1))
+
+extern void sim_sleep(void);
+
+#define set_sleep_mode(mode) (SMCR = (SMCR & _BV(SE)) | (mode))
+#define sleep_enable()       (SMCR |= _BV(SE))
+#define sleep_disable()      (SMCR &= ~_BV(SE))
+#define sleep_cpu()          sim_sleep()
+
+#endif /* HOST_AVR_SLEEP_H_ */
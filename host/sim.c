@@ -0,0 +1,499 @@
+/******************************************************************************
+ * Host simulator of a Simon board.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <avr/sleep.h>
+
+#include "sim.h"
+#include "board.h"
+
+// I/O registers of host/avr/io.h
+volatile uint8_t SREG;
+volatile uint8_t PINB, DDRB, PORTB, PINC, DDRC, PORTC, PIND, DDRD, PORTD;
+volatile uint8_t TIFR0, TIFR1, TIFR2, PCIFR;
+volatile uint8_t EECR, EEDR;
+volatile uint16_t EEAR;
+volatile uint8_t GTCCR;
+volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B;
+volatile uint8_t SMCR, MCUCR, ACSR, CLKPR, PRR;
+volatile uint8_t PCICR, PCMSK0, PCMSK1, PCMSK2;
+volatile uint8_t TIMSK0, TIMSK1, TIMSK2;
+volatile uint8_t ADCSRA;
+volatile uint8_t TCCR1A, TCCR1B, TCCR1C;
+volatile uint16_t TCNT1, OCR1A, OCR1B;
+volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B;
+volatile uint8_t ASSR;
+volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UDR0;
+volatile uint16_t UBRR0;
+
+// Vectors that the firmware does not define in some configurations
+#define SIM_VECTOR(vector) void vector(void) __attribute__((weak)); void vector(void) {}
+SIM_VECTOR(PCINT0_vect)
+SIM_VECTOR(PCINT1_vect)
+SIM_VECTOR(PCINT2_vect)
+SIM_VECTOR(TIMER1_COMPA_vect)
+SIM_VECTOR(TIMER1_OVF_vect)
+SIM_VECTOR(TIMER0_COMPA_vect)
+SIM_VECTOR(USART_RX_vect)
+SIM_VECTOR(USART_UDRE_vect)
+SIM_VECTOR(EE_READY_vect)
+
+uint64_t sim_time;
+void (*sim_ms_hook)(void);
+uint64_t sim_limit;
+jmp_buf *sim_abort;
+sim_stats_t sim_stats;
+uint8_t sim_eeprom[E2END + 1];
+uint8_t sim_tx[SIM_TX_SIZE];
+uint32_t sim_tx_len;
+
+// EEPROM write time (it has its own oscillator) and size of USART frame (8N1)
+#define SIM_EEPROM_WRITE ((uint64_t)(F_CPU * 0.0034))
+#define SIM_USART_BITS   10
+
+// Cycles of firmware on ATmega168, estimated from its C code as avr-gcc -Os compiles
+// an ISR (no AVR listing was available to calibrate them): 26 cycles of interrupt
+// response, jmp from the vector, prologue, epilogue and reti, 4 cycles to push and
+// pop each register that the ISR uses, and its body (2 cycles per lds/sts/ld/st,
+// 3 per lpm, 1 per ALU instruction and skipped branch, 2 per taken one)
+sim_cycles_t sim_cycles = {
+	105, // timer0: 26 + 10 registers + 13 per tick, 56 more to sample buttons every other tick
+	100, // timer1_ovf: 26 + 10 registers + 23 to flip and count, 11 for fractional top
+	110, // timer1_compa: 26 + 8 registers + 52 to load the next note into both timers
+	50,  // usart_rx: 26 + 1 register + 8 to read UDR0 and set the request flag
+	75,  // usart_udre: 26 + 5 registers + 29 to send a byte from the ring buffer
+	100, // eeprom: 26 + 8 registers + 42 to write the next byte of a record
+	33,  // pcint: 26 + 1 register + 3 to take Timer0
+	30   // wake: sleep_disable, cli, checks of a wait loop, set_sleep_mode, sleep_enable, sei
+};
+
+// Typical supply current of ATmega168 at 3 V from the datasheet (without leds and
+// buzzer), active and idle ones grow with clock frequency, power-down one does not
+// (watchdog and brown-out detector are off), and start-up from power-down (in CPU
+// cycles of the internal RC oscillator)
+#define SIM_ACTIVE_UA_MHZ 550.0
+#define SIM_IDLE_UA_MHZ   150.0
+#define SIM_DOWN_UA       0.2
+#define SIM_STARTUP_CK    6
+
+// Next millisecond boundary for sim_ms_hook
+static uint64_t ms_next;
+
+// Timer0 compare match: running flag, time of the next and the last one
+static uint8_t t0_on;
+static uint64_t t0_next;
+static uint64_t t0_last;
+
+// Timer1 interrupt: running flag, time of the next one and current (latched) top
+static uint8_t t1_on;
+static uint64_t t1_next;
+static uint16_t t1_top;
+
+// USART: time when transmitter and receiver are free again, and received bytes
+static uint64_t tx_free;
+static uint64_t rx_free;
+static uint8_t rx_queue[256];
+static uint8_t rx_head;
+static uint8_t rx_tail;
+
+// EEPROM: time when the current write is over
+static uint64_t ee_free;
+
+// State of CPU while virtual time advances, and time when the interrupts and main program
+// that were charged to it are over (it is behind sim_time while CPU sleeps)
+enum { CPU_AWAKE, CPU_IDLE, CPU_DOWN };
+static int cpu_mode;
+static uint64_t cpu_busy;
+
+// Buttons held down and a pin change interrupt that they caused
+static uint8_t buttons;
+static int pins_woke;
+
+// Button changes scheduled at any time (ring buffer in the order of their time)
+#define SIM_PINS_QUEUE 16
+static uint64_t pins_at[SIM_PINS_QUEUE];
+static uint8_t pins_mask[SIM_PINS_QUEUE];
+static uint8_t pins_head;
+static uint8_t pins_len;
+
+// Prescalers of Timer0/Timer1 and of Timer2 by clock select bits
+static const uint16_t T01_PRESCALER[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+static const uint16_t T2_PRESCALER[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+
+static void sim_fatal(const char *msg) {
+	if (sim_abort)
+		longjmp(*sim_abort, 1);
+	fprintf(stderr, "sim: %s at %.3f ms\n", msg, sim_time / (double)SIM_MS);
+	exit(2);
+}
+
+// Returns F_CPU cycles per cycle of I/O clock (scaled by CLKPR)
+static uint64_t sim_clk(void) {
+	return (uint64_t)1 << (CLKPR & 0x0f);
+}
+
+// Returns frequency of CPU clock in MHz (scaled by CLKPR)
+static double sim_mhz(void) {
+	return F_CPU / 1000000.0 / sim_clk();
+}
+
+// Charges CPU sleep from the end of its work until now
+static void sim_slept(void) {
+	if (sim_time <= cpu_busy)
+		return;
+	uint64_t t = sim_time - cpu_busy;
+	if (cpu_mode == CPU_DOWN) {
+		sim_stats.down_time += t;
+		sim_stats.charge += SIM_DOWN_UA * t / F_CPU;
+	} else {
+		sim_stats.idle_time += t;
+		sim_stats.charge += SIM_IDLE_UA_MHZ * sim_mhz() * t / F_CPU;
+	}
+	cpu_busy = sim_time;
+}
+
+// Charges CPU running for a number of cycles after the work charged before
+static void sim_run(uint16_t cycles) {
+	uint64_t t = (uint64_t)cycles * sim_clk();
+	if (cpu_busy < sim_time)
+		cpu_busy = sim_time;
+	cpu_busy += t;
+	sim_stats.cycles += cycles;
+	sim_stats.active_time += t;
+	sim_stats.charge += SIM_ACTIVE_UA_MHZ * sim_mhz() * t / F_CPU;
+}
+
+// Charges an interrupt, that wakes CPU up if it sleeps
+static void sim_isr(uint16_t cycles) {
+	if (cpu_mode != CPU_AWAKE) {
+		sim_slept();
+		if (cpu_mode == CPU_DOWN) {
+			uint64_t t = SIM_STARTUP_CK * sim_clk(); // oscillator starts before the ISR
+			sim_stats.down_time += t;
+			sim_stats.charge += SIM_DOWN_UA * t / F_CPU;
+			cpu_busy += t;
+		}
+		cpu_mode = CPU_AWAKE;
+	}
+	sim_run(cycles);
+	sim_stats.isr_cycles += cycles;
+}
+
+uint64_t sim_cpu_time(void) {
+	return cpu_busy > sim_time ? cpu_busy : sim_time;
+}
+
+// Returns F_CPU cycles per Timer0 compare period
+static uint64_t t0_period(void) {
+	return (uint64_t)(OCR0A + 1) * T01_PRESCALER[TCCR0B & 7] * sim_clk();
+}
+
+// Returns F_CPU cycles per Timer1 period with a given top
+static uint64_t t1_period(uint16_t top) {
+	return ((uint64_t)top + 1) * T01_PRESCALER[TCCR1B & 7] * sim_clk();
+}
+
+// Returns F_CPU cycles per USART frame
+static uint64_t usart_frame(void) {
+	return SIM_USART_BITS * ((UCSR0A & _BV(U2X0)) ? 8 : 16) * ((uint64_t)UBRR0 + 1) * sim_clk();
+}
+
+// Returns true when Timer1 runs in Fast PWM mode with interrupt on overflow at top
+static int t1_pwm(void) {
+	return (TCCR1B & _BV(WGM13)) != 0;
+}
+
+// Updates timer counters for the firmware to read at current time
+static void sim_counters(void) {
+	if (t0_on) {
+		uint64_t cnt = (sim_time - t0_last) / (T01_PRESCALER[TCCR0B & 7] * sim_clk());
+		TCNT0 = cnt > OCR0A ? OCR0A : cnt;
+	}
+	uint16_t p2 = T2_PRESCALER[TCCR2B & 7];
+	if (p2) {
+		uint64_t cnt = sim_time / (p2 * sim_clk());
+		TCNT2 = (TCCR2A & _BV(WGM21)) ? cnt % ((uint16_t)OCR2A + 1) : (uint8_t)cnt;
+	}
+}
+
+// Starts and stops timers according to registers written by the firmware
+static void sim_sync(void) {
+	if ((TIMSK0 & _BV(OCIE0A)) && T01_PRESCALER[TCCR0B & 7]) {
+		if (!t0_on) {
+			t0_on = 1;
+			t0_last = sim_time;
+			t0_next = sim_time + t0_period();
+		}
+	} else
+		t0_on = 0;
+	uint8_t irq = t1_pwm() ? TIMSK1 & _BV(TOIE1) : TIMSK1 & _BV(OCIE1A);
+	if (irq && T01_PRESCALER[TCCR1B & 7]) {
+		// the firmware clears pending flag when it (re)starts the timer from zero
+		// (top is loaded directly then, as the firmware writes it before it enters PWM mode)
+		if (!t1_on || (TIFR1 & (_BV(TOV1) | _BV(OCF1A)))) {
+			t1_on = 1;
+			t1_top = OCR1A;
+			t1_next = sim_time + t1_period(t1_top);
+		}
+	} else
+		t1_on = 0;
+	TIFR1 = 0;
+	TIFR0 = 0;
+}
+
+// Applies buttons to pins, runs pin change ISRs, returns true if any ran
+static int sim_pins(void) {
+	uint8_t p1 = 0;
+	uint8_t p2 = 0;
+	if (buttons & 1) { p1 |= BUTTON0_P1; p2 |= BUTTON0_P2; }
+	if (buttons & 2) { p1 |= BUTTON1_P1; p2 |= BUTTON1_P2; }
+	if (buttons & 4) { p1 |= BUTTON2_P1; p2 |= BUTTON2_P2; }
+	if (buttons & 8) { p1 |= BUTTON3_P1; p2 |= BUTTON3_P2; }
+	uint8_t changed1 = (BOARD_PIN(1) ^ ~p1) & BUTTONS_MASK(1);
+	uint8_t changed2 = (BOARD_PIN(2) ^ ~p2) & BUTTONS_MASK(2);
+	BOARD_PIN(1) = (BOARD_PIN(1) & ~BUTTONS_MASK(1)) | (~p1 & BUTTONS_MASK(1));
+	BOARD_PIN(2) = (BOARD_PIN(2) & ~BUTTONS_MASK(2)) | (~p2 & BUTTONS_MASK(2));
+	int woke = 0;
+	sim_counters();
+	if ((PCICR & BOARD_PCIE(1)) && (changed1 & BOARD_PCMSK(1))) {
+		sim_stats.pcint++;
+		sim_isr(sim_cycles.pcint);
+		BOARD_PCINT_vect(1)();
+		woke = 1;
+	}
+	if ((PCICR & BOARD_PCIE(2)) && (changed2 & BOARD_PCMSK(2))) {
+		sim_stats.pcint++;
+		sim_isr(sim_cycles.pcint);
+		BOARD_PCINT_vect(2)();
+		woke = 1;
+	}
+	return woke;
+}
+
+void sim_reset(void) {
+	SREG = 0;
+	PINB = PINC = PIND = 0xff;
+	DDRB = DDRC = DDRD = 0;
+	PORTB = PORTC = PORTD = 0;
+	TIFR0 = TIFR1 = TIFR2 = PCIFR = 0;
+	EECR = EEDR = 0;
+	EEAR = 0;
+	GTCCR = 0;
+	TCCR0A = TCCR0B = TCNT0 = OCR0A = OCR0B = 0;
+	SMCR = MCUCR = ACSR = CLKPR = PRR = 0;
+	PCICR = PCMSK0 = PCMSK1 = PCMSK2 = 0;
+	TIMSK0 = TIMSK1 = TIMSK2 = 0;
+	ADCSRA = 0;
+	TCCR1A = TCCR1B = TCCR1C = 0;
+	TCNT1 = OCR1A = OCR1B = 0;
+	TCCR2A = TCCR2B = TCNT2 = OCR2A = OCR2B = 0;
+	ASSR = 0;
+	UCSR0A = _BV(UDRE0);
+	UCSR0B = UCSR0C = UDR0 = 0;
+	UBRR0 = 0;
+	sim_time = 0;
+	ms_next = SIM_MS;
+	t0_on = t1_on = 0;
+	t1_top = 0;
+	tx_free = rx_free = ee_free = 0;
+	rx_head = rx_tail = 0;
+	cpu_mode = CPU_AWAKE;
+	cpu_busy = 0;
+	buttons = 0;
+	pins_head = pins_len = 0;
+	memset(&sim_stats, 0, sizeof(sim_stats));
+	memset(sim_eeprom, 0xff, sizeof(sim_eeprom));
+	sim_tx_len = 0;
+}
+
+// Events in the order of their priority at the same time
+enum { EV_MS, EV_PIN, EV_T1, EV_T0, EV_RX, EV_TX, EV_EE, EV_NONE };
+
+void sim_sleep(void) {
+	int down = (SMCR & (_BV(SM0) | _BV(SM1) | _BV(SM2))) == SLEEP_MODE_PWR_DOWN;
+	uint64_t down_from = sim_time;
+	sim_run(sim_cycles.wake); // main program since the last wake-up
+	cpu_mode = down ? CPU_DOWN : CPU_IDLE;
+	sim_stats.sleeps++;
+	if (down) {
+		sim_stats.power_down++;
+		if (!(PCICR & (BOARD_PCIE(1) | BOARD_PCIE(2))))
+			sim_fatal("power-down without pin change interrupts");
+	}
+	sim_sync();
+	for (;;) {
+		int ev = EV_MS;
+		uint64_t t = ms_next;
+		if (pins_len) {
+			uint64_t at = pins_at[pins_head] > sim_time ? pins_at[pins_head] : sim_time;
+			if (at < t) { t = at; ev = EV_PIN; }
+		}
+		if (!down) {
+			int any = 0;
+			if (t1_on) {
+				any = 1;
+				if (t1_next < t) { t = t1_next; ev = EV_T1; }
+			}
+			if (t0_on) {
+				any = 1;
+				if (t0_next < t) { t = t0_next; ev = EV_T0; }
+			}
+			if ((UCSR0B & _BV(RXEN0)) && (UCSR0B & _BV(RXCIE0)) && rx_head != rx_tail) {
+				uint64_t at = rx_free > sim_time ? rx_free : sim_time;
+				if (at < t) { t = at; ev = EV_RX; }
+			}
+			if ((UCSR0B & _BV(TXEN0)) && (UCSR0B & _BV(UDRIE0))) {
+				any = 1;
+				uint64_t at = tx_free > sim_time ? tx_free : sim_time;
+				if (at < t) { t = at; ev = EV_TX; }
+			}
+			if (EECR & _BV(EERIE)) {
+				any = 1;
+				uint64_t at = ee_free > sim_time ? ee_free : sim_time;
+				if (at < t) { t = at; ev = EV_EE; }
+			}
+			if (!any && !(PCICR & (BOARD_PCIE(1) | BOARD_PCIE(2))) && !(UCSR0B & _BV(RXCIE0)))
+				sim_fatal("sleep without wake-up source");
+		}
+		if (sim_limit && t > sim_limit) {
+			sim_time = sim_limit;
+			sim_fatal("time limit reached");
+		}
+		sim_time = t;
+		switch (ev) {
+		case EV_MS:
+			ms_next += SIM_MS;
+			pins_woke = 0;
+			if (sim_ms_hook)
+				sim_ms_hook();
+			if (pins_woke) {
+				if (down) {
+					// clocks were stopped, timers continue from where they were
+					uint64_t slept = sim_time - down_from;
+					t0_next += slept;
+					t0_last += slept;
+					t1_next += slept;
+				}
+				sim_sync();
+				return;
+			}
+			continue;
+		case EV_PIN:
+			buttons = pins_mask[pins_head];
+			pins_head = (pins_head + 1) % SIM_PINS_QUEUE;
+			pins_len--;
+			if (down) {
+				// clocks were stopped, timers continue from where they were
+				uint64_t slept = sim_time - down_from;
+				t0_next += slept;
+				t0_last += slept;
+				t1_next += slept;
+				down_from = sim_time;
+			}
+			if (!sim_pins())
+				continue; // masked pin changes do not wake CPU up
+			break;
+		case EV_T1:
+			sim_stats.timer1++;
+			sim_counters();
+			if (t1_pwm()) {
+				t1_top = OCR1A; // double-buffered top is updated at top
+				sim_isr(sim_cycles.timer1_ovf);
+				TIMER1_OVF_vect();
+			} else {
+				TCNT1 = 0;
+				sim_isr(sim_cycles.timer1_compa);
+				TIMER1_COMPA_vect();
+				t1_top = OCR1A;
+			}
+			t1_next = sim_time + t1_period(t1_top);
+			break;
+		case EV_T0:
+			sim_stats.timer0++;
+			t0_last = sim_time;
+			sim_counters();
+			sim_isr(sim_cycles.timer0);
+			TIMER0_COMPA_vect();
+			t0_next = sim_time + t0_period();
+			break;
+		case EV_RX:
+			sim_stats.usart++;
+			sim_counters();
+			UDR0 = rx_queue[rx_head++];
+			sim_isr(sim_cycles.usart_rx);
+			USART_RX_vect();
+			rx_free = sim_time + usart_frame();
+			break;
+		case EV_TX:
+			sim_stats.usart++;
+			sim_counters();
+			sim_isr(sim_cycles.usart_udre);
+			USART_UDRE_vect();
+			if (sim_tx_len < SIM_TX_SIZE)
+				sim_tx[sim_tx_len++] = UDR0;
+			tx_free = sim_time + usart_frame();
+			break;
+		case EV_EE:
+			sim_stats.eeprom++;
+			sim_counters();
+			sim_isr(sim_cycles.eeprom);
+			EE_READY_vect();
+			if (EECR & _BV(EEPE)) {
+				sim_stats.ee_writes++;
+				sim_eeprom[EEAR & E2END] = EEDR;
+				EECR &= ~(_BV(EEPE) | _BV(EEMPE));
+				ee_free = sim_time + SIM_EEPROM_WRITE;
+			}
+			break;
+		}
+		sim_sync();
+		sim_counters();
+		return;
+	}
+}
+
+void sim_set_buttons(uint8_t mask) {
+	buttons = mask & 0x0f;
+	if (sim_pins())
+		pins_woke = 1;
+}
+
+void sim_set_buttons_at(uint8_t mask, uint64_t at) {
+	if (pins_len == SIM_PINS_QUEUE)
+		sim_fatal("too many scheduled button changes");
+	if (pins_len && at < pins_at[(pins_head + pins_len - 1) % SIM_PINS_QUEUE])
+		sim_fatal("button changes scheduled out of order");
+	uint8_t i = (pins_head + pins_len++) % SIM_PINS_QUEUE;
+	pins_at[i] = at;
+	pins_mask[i] = mask & 0x0f;
+}
+
+uint8_t sim_buttons(void) {
+	return buttons;
+}
+
+uint8_t sim_leds(void) {
+	uint8_t p1 = BOARD_PORT(1);
+	uint8_t p2 = BOARD_PORT(2);
+	uint8_t leds = 0;
+	if ((p1 & LED0_P1) || (p2 & LED0_P2)) leds |= 1;
+	if ((p1 & LED1_P1) || (p2 & LED1_P2)) leds |= 2;
+	if ((p1 & LED2_P1) || (p2 & LED2_P2)) leds |= 4;
+	if ((p1 & LED3_P1) || (p2 & LED3_P2)) leds |= 8;
+	return leds;
+}
+
+void sim_rx(uint8_t b) {
+	rx_queue[rx_tail++] = b;
+}
+
+uint8_t eeprom_read_byte(const uint8_t *addr) {
+	return sim_eeprom[(uintptr_t)addr & E2END];
+}
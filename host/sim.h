@@ -0,0 +1,131 @@
+/******************************************************************************
+ * Host simulator of a Simon board.
+ * Firmware sources are compiled with the host compiler against the shim
+ * headers in host/avr, where I/O registers are plain variables and ISRs are
+ * plain functions. Virtual time advances only in sleep_cpu(), which jumps
+ * straight to the next interrupt of Timer0 (system tick), Timer1 (buzzer),
+ * USART and EEPROM, models the registers that change meanwhile and calls the
+ * ISR. Timers are scaled by CLKPR, and power-down sleep stops them until a
+ * pin change. Everything outside the board (buttons, a serial host) is
+ * driven by sim_ms_hook, which is called once per virtual millisecond, or
+ * scheduled at any clock cycle (buttons), so a run is exactly reproducible
+ * and goes as fast as the host can execute the firmware.
+ * Firmware code runs on the host, so its AVR cycles are not known: every
+ * interrupt and every stretch of the main program between a wake-up and the
+ * next sleep is charged with cycles from the sim_cycles table (estimated from
+ * the code, see sim.c). They do not shift virtual time, the timers run on
+ * their own as on a board, but they split it into active, idle and
+ * power-down time of CPU at its current clock, and into supply charge from
+ * typical currents of ATmega168.
+ *****************************************************************************/
+
+#ifndef HOST_SIM_H_
+#define HOST_SIM_H_
+
+#include <stdint.h>
+#include <setjmp.h>
+
+#include <avr/io.h>
+
+// Virtual time in F_CPU clock cycles since sim_reset
+extern uint64_t sim_time;
+
+// Number of clock cycles in one virtual millisecond
+#define SIM_MS ((uint64_t)(F_CPU / 1000))
+
+// Called once per virtual millisecond (before system tick ISR), may be NULL
+extern void (*sim_ms_hook)(void);
+
+// Virtual time limit (0 for none) and where to jump when it is reached
+// (when sim_abort is NULL the program exits with an error instead)
+extern uint64_t sim_limit;
+extern jmp_buf *sim_abort;
+
+// Supply voltage of the board (2 AA cells) for energy estimates
+#define SIM_VCC 3.0
+
+// CPU cycles of each interrupt (from the interrupt response to reti) and of the main
+// program from a wake-up to the next sleep, they may be set before a run
+typedef struct {
+	uint16_t timer0;       // system tick (average of ticks with and without sample of buttons)
+	uint16_t timer1_ovf;   // half period of Timer1 buzzer backend
+	uint16_t timer1_compa; // end of note of Timer2 buzzer backend
+	uint16_t usart_rx;     // received byte
+	uint16_t usart_udre;   // byte to send
+	uint16_t eeprom;       // EEPROM ready
+	uint16_t pcint;        // pin change of buttons
+	uint16_t wake;         // main program between a wake-up and the next sleep
+} sim_cycles_t;
+
+extern sim_cycles_t sim_cycles;
+
+// Counters of wake-ups and interrupts, and time split by state of CPU (in F_CPU cycles)
+typedef struct {
+	uint32_t sleeps;      // sleep_cpu calls
+	uint32_t power_down;  // of them in power-down mode
+	uint32_t timer0;      // system ticks
+	uint32_t timer1;      // buzzer interrupts
+	uint32_t usart;       // USART interrupts
+	uint32_t eeprom;      // EEPROM ready interrupts
+	uint32_t ee_writes;   // bytes written into EEPROM
+	uint32_t pcint;       // pin change interrupts
+	uint64_t cycles;      // CPU cycles executed (by sim_cycles)
+	uint64_t isr_cycles;  // of them in interrupts
+	uint64_t active_time; // time CPU runs
+	uint64_t idle_time;   // time in idle sleep
+	uint64_t down_time;   // time in power-down (with start-up of oscillator)
+	double charge;        // supply charge of MCU in uC (without leds and buzzer)
+} sim_stats_t;
+
+extern sim_stats_t sim_stats;
+
+// EEPROM contents (erased to 0xff by sim_reset)
+extern uint8_t sim_eeprom[E2END + 1];
+
+// Bytes sent by USART
+#define SIM_TX_SIZE 65536
+extern uint8_t sim_tx[SIM_TX_SIZE];
+extern uint32_t sim_tx_len;
+
+// Resets registers, time, statistics, USART and EEPROM to power-on state
+// (firmware variables are not touched, run every board in a fresh process)
+extern void sim_reset(void);
+
+// Sleeps until the next interrupt and runs it (sleep_cpu of host/avr/sleep.h)
+extern void sim_sleep(void);
+
+// Sets bitmask of buttons held down (0..15), pins follow immediately
+extern void sim_set_buttons(uint8_t mask);
+
+// Schedules buttons held down (0..15) from virtual time at (in clock cycles,
+// between milliseconds, too), changes must be scheduled in the order of time
+extern void sim_set_buttons_at(uint8_t mask, uint64_t at);
+
+// Returns bitmask of buttons held down
+extern uint8_t sim_buttons(void);
+
+// Returns bitmask of leds that are lit now
+extern uint8_t sim_leds(void);
+
+// Receives a byte on USART RX (its ISR runs on the next sleep)
+extern void sim_rx(uint8_t b);
+
+// Returns virtual time when CPU gets to the firmware code that runs now, that is
+// after interrupts and main program that were charged before it (see sim_cycles)
+extern uint64_t sim_cpu_time(void);
+
+// Returns next 64 bits of a host generator with a given state (splitmix64), for
+// scripts of tests and tools that must not depend on the firmware generator
+static inline uint64_t sim_rand(uint64_t *state) {
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+// Returns virtual time in milliseconds
+static inline uint64_t sim_ms(void) {
+	return sim_time / SIM_MS;
+}
+
+#endif /* HOST_SIM_H_ */
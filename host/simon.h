@@ -0,0 +1,16 @@
+/******************************************************************************
+ * Simon.c for host programs that drive the whole game on the simulator.
+ * Firmware main() and random() are renamed, as they clash with the host
+ * ones (include it into one file only).
+ *****************************************************************************/
+
+#ifndef HOST_SIMON_H_
+#define HOST_SIMON_H_
+
+#define main simon_main
+#define random simon_random
+#include "Simon.c"
+#undef main
+#undef random
+
+#endif /* HOST_SIMON_H_ */
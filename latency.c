@@ -0,0 +1,76 @@
+/******************************************************************************
+ * Press-to-feedback latency instrumentation.
+ *****************************************************************************/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "latency.h"
+#include "systick.h"
+#include "telemetry.h"
+
+#ifdef LATENCY
+
+// Accumulated latencies (read them with simulator or debugger, or dump with TELEMETRY)
+latency_stats_t latency_stats[LATENCY_KINDS];
+
+// Time of the last press edge (written by system tick ISR)
+volatile uint16_t latency_edge_ms;
+volatile uint8_t latency_edge_cnt;
+
+// Bitmask of latency kinds that are not marked since the last press edge
+volatile uint8_t latency_armed;
+
+// Records latency of a given kind from the last press edge (only once per edge)
+void latency_mark(uint8_t kind) {
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t ms = systick_ms;
+	uint8_t cnt = TCNT0;
+	if ((TIFR0 & _BV(OCF0A)) && cnt < SYSTICK_TOP)
+		ms++; // counter has restarted, but ISR has not counted this millisecond yet
+	uint16_t edge_ms = latency_edge_ms;
+	uint8_t edge_cnt = latency_edge_cnt;
+	uint8_t armed = latency_armed;
+	latency_armed = armed & ~_BV(kind);
+	SREG = sreg;
+	if (!(armed & _BV(kind)))
+		return;
+	// difference of 16-bit millis is exact for latencies under 65 seconds
+	uint32_t ticks = (uint32_t)(uint16_t)(ms - edge_ms) * (SYSTICK_TOP + 1) + cnt - edge_cnt;
+	uint16_t lat = ticks > 0xffff ? 0xffff : ticks;
+	latency_stats_t *stats = &latency_stats[kind];
+	if (stats->count == 0xffff)
+		return; // full, sum cannot overflow
+	if (stats->count == 0 || lat < stats->min)
+		stats->min = lat;
+	if (lat > stats->max)
+		stats->max = lat;
+	stats->count++;
+	stats->sum += lat;
+	uint8_t bucket = 0;
+	for (lat /= LATENCY_BUCKET0; lat != 0 && bucket < LATENCY_BUCKETS - 1; lat >>= 1)
+		bucket++;
+	stats->buckets[bucket]++;
+}
+
+// Length of Timer0 tick in 1/256 of microsecond
+#define LATENCY_TICK_US_FP8 ((uint16_t)(SYSTICK_PRESCALER * 256000000.0 / F_CPU + 0.5))
+
+// Sends accumulated latencies as TELEMETRY_LATENCY events (waits for buffer room)
+void latency_dump() {
+	uint8_t kind;
+	uint8_t i;
+	telemetry_send(TELEMETRY_LATENCY, LATENCY_TICK_US_FP8, 0, LATENCY_FIELD_TICK);
+	for (kind = 0; kind < LATENCY_KINDS; kind++) {
+		latency_stats_t *stats = &latency_stats[kind];
+		telemetry_send(TELEMETRY_LATENCY, stats->count, kind, LATENCY_FIELD_COUNT);
+		telemetry_send(TELEMETRY_LATENCY, stats->min, kind, LATENCY_FIELD_MIN);
+		telemetry_send(TELEMETRY_LATENCY, stats->count ? stats->sum / stats->count : 0, kind, LATENCY_FIELD_AVG);
+		telemetry_send(TELEMETRY_LATENCY, stats->max, kind, LATENCY_FIELD_MAX);
+		for (i = 0; i < LATENCY_BUCKETS; i++)
+			telemetry_send(TELEMETRY_LATENCY, stats->buckets[i], kind, LATENCY_FIELD_BUCKET0 + i);
+	}
+}
+
+#endif /* LATENCY */
@@ -0,0 +1,81 @@
+/******************************************************************************
+ * Press-to-feedback latency instrumentation.
+ * The system tick ISR stamps the first raw sample of a button press (before
+ * debounce), and the game marks the moments when the button led is lit and
+ * its tone starts. Latencies from the edge to each mark are measured in
+ * Timer0 ticks (SYSTICK_TOP + 1 per millisecond) and accumulated into
+ * latency_stats in SRAM: count, min, max, sum and a histogram with
+ * power-of-2 buckets, where bucket i > 0 counts latencies in
+ * [LATENCY_BUCKET0 << (i - 1), LATENCY_BUCKET0 << i) ticks.
+ * A simulator or debugger can read latency_stats directly; with TELEMETRY
+ * any byte received on RX makes wait_start dump them as TELEMETRY_LATENCY
+ * events (see tools/telemetry.py).
+ * Define LATENCY during compilation to enable it.
+ *****************************************************************************/
+
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include <avr/io.h>
+
+#include "systick.h"
+
+// Measured latencies
+#define LATENCY_LED    0 // from press to led on
+#define LATENCY_SOUND  1 // from press to buzzer start
+#define LATENCY_KINDS  2
+
+// Histogram buckets, the last one counts everything longer
+#define LATENCY_BUCKETS 12
+
+// Upper bound of the first bucket (in Timer0 ticks)
+#define LATENCY_BUCKET0 8
+
+// Fields of TELEMETRY_LATENCY events
+#define LATENCY_FIELD_COUNT   0
+#define LATENCY_FIELD_MIN     1
+#define LATENCY_FIELD_AVG     2
+#define LATENCY_FIELD_MAX     3
+#define LATENCY_FIELD_BUCKET0 4    // and the following LATENCY_BUCKETS - 1 ones
+#define LATENCY_FIELD_TICK    0xff // Timer0 tick length in 1/256 of microsecond
+
+#ifdef LATENCY
+
+// Accumulated latencies of one kind (in Timer0 ticks, saturated at 0xffff)
+typedef struct {
+	uint16_t count;
+	uint16_t min;
+	uint16_t max;
+	uint32_t sum;
+	uint16_t buckets[LATENCY_BUCKETS];
+} latency_stats_t;
+
+extern latency_stats_t latency_stats[LATENCY_KINDS];
+
+// Time of the last press edge (written by system tick ISR)
+extern volatile uint16_t latency_edge_ms;
+extern volatile uint8_t latency_edge_cnt;
+
+// Bitmask of latency kinds that are not marked since the last press edge
+extern volatile uint8_t latency_armed;
+
+// Stamps press edge, it is called from system tick ISR
+static inline void latency_edge() {
+	latency_edge_ms = systick_ms;
+	latency_edge_cnt = TCNT0;
+	latency_armed = _BV(LATENCY_KINDS) - 1;
+}
+
+// Records latency of a given kind from the last press edge (only once per edge)
+extern void latency_mark(uint8_t kind);
+
+// Sends accumulated latencies as TELEMETRY_LATENCY events (waits for buffer room)
+extern void latency_dump();
+
+#else /* LATENCY */
+static inline void latency_edge() {}
+static inline void latency_mark(uint8_t kind) {}
+static inline void latency_dump() {}
+#endif /* LATENCY */
+
+#endif /* LATENCY_H_ */
@@ -0,0 +1,91 @@
+/******************************************************************************
+ * Pseudo-random number generators for game sequences.
+ * A game is reproduced from its seed, so the generator must be deterministic
+ * and cheap on an 8-bit core. Select one with RAND_BACKEND=<id> during
+ * compilation (RAND_XORSHIFT32 by default). Xorshift generators use only
+ * shifts and XORs (shifts by 8 are plain byte moves), while LCG needs a
+ * 32-bit multiply. Buttons are taken from the most significant bits of the
+ * state, which are the best ones for all backends. test/test_rand.c checks
+ * games of each backend (make test_rand): 16-bit state has only 65535
+ * distinct games, so over millions of games their longest runs of the same
+ * button deviate from random ones, and it is no longer the default.
+ * Cycles of rand_next on ATmega168 are estimated below from the code that
+ * avr-gcc -Os generates for such shifts and multiplies (no AVR listing was
+ * available to count them): 8 cycles to load and 8 to store a 32-bit seed
+ * (half of it for 16 bits), 1 per register shift or XOR. A game of n buttons
+ * calls it n * (n + 1) times (every round plays the sequence back and checks
+ * it from the seed), 650 calls for 25 buttons, so even the slowest one costs
+ * 0.1 s of CPU per game at 1 MHz, and the fastest 0.02 s.
+ *****************************************************************************/
+
+#ifndef RAND_H_
+#define RAND_H_
+
+#include <stdint.h>
+
+// Known generators and estimated cycles per call:
+// RAND_LCG32 about 80: 32-bit multiply is a call of __mulsi3 from libgcc, that takes
+// about 50 cycles with the hardware 8x8 MUL (10 partial products of which the low 32
+// bits are kept), 4 ldi of the constant, 4 for + 1 and 16 to load and store the seed;
+// RAND_XORSHIFT16 about 25: << 7 is a right shift by 1 with the bytes swapped,
+// >> 9 and << 8 are byte moves with a shift of 1 and none;
+// RAND_XORSHIFT32 about 60 when << 13, >> 17 and << 5 are byte moves plus 5, 1 and 5
+// shifts of 4 registers, but up to 150 when the compiler emits each one as a loop of
+// single-bit shifts (7 cycles per bit, as older avr-gcc versions do with -Os)
+#define RAND_LCG32      1 // 32-bit linear congruential (a = 22695477, c = 1), period 2^32
+#define RAND_XORSHIFT16 2 // 16-bit xorshift (7, 9, 8), period 2^16 - 1
+#define RAND_XORSHIFT32 3 // 32-bit xorshift (13, 17, 5), period 2^32 - 1
+
+#ifndef RAND_BACKEND
+#define RAND_BACKEND RAND_XORSHIFT32
+#endif
+
+// Typedef for random seed (generator state)
+#if RAND_BACKEND == RAND_XORSHIFT16
+typedef union {
+	uint16_t value;
+	uint8_t bytes[2];
+} rand_seed_t;
+#define RAND_SEED_MSB 1
+#else
+typedef union {
+	uint32_t value;
+	uint8_t bytes[4];
+} rand_seed_t;
+#define RAND_SEED_MSB 3
+#endif
+
+// Advances the seed to the next state and returns its most significant byte
+static inline uint8_t rand_next(rand_seed_t *seed) {
+#if RAND_BACKEND == RAND_LCG32
+	seed->value = seed->value * 22695477UL + 1;
+#elif RAND_BACKEND == RAND_XORSHIFT16
+	uint16_t x = seed->value;
+	x ^= x << 7;
+	x ^= x >> 9;
+	x ^= x << 8;
+	seed->value = x;
+#elif RAND_BACKEND == RAND_XORSHIFT32
+	uint32_t x = seed->value;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	seed->value = x;
+#else
+#error Unknown RAND_BACKEND
+#endif
+	return seed->bytes[RAND_SEED_MSB];
+}
+
+// Mixes two bytes of entropy into the seed before the next step
+// (xorshift state never becomes zero, as it would stay zero forever)
+static inline void rand_mix(rand_seed_t *seed, uint8_t a, uint8_t b) {
+	seed->bytes[0] ^= a;
+	seed->bytes[1] ^= b;
+#if RAND_BACKEND != RAND_LCG32
+	if (seed->value == 0)
+		seed->value = 1;
+#endif
+}
+
+#endif /* RAND_H_ */
@@ -0,0 +1,100 @@
+/******************************************************************************
+ * Recorder of game sessions for deterministic replay.
+ *****************************************************************************/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "record.h"
+#include "telemetry.h"
+
+#ifdef RECORD
+
+// Recorded session (ring buffer with TELEMETRY), number of bytes recorded and sent
+uint8_t record_log[RECORD_SIZE];
+volatile uint16_t record_len;
+volatile uint16_t record_sent;
+
+// Time of the last recorded edge
+uint16_t record_last;
+
+// True while recording, false before the first session or when the log is full
+volatile uint8_t record_on;
+
+// True when some edges did not fit into the log
+volatile uint8_t record_truncated;
+
+// Starts recording of a new session
+void record_start(uint8_t level, const void *seed, uint8_t seed_size) {
+	uint8_t i;
+	telemetry_send(TELEMETRY_RECORD, RECORD_HEADER_OFFSET, seed_size, 0);
+	uint8_t sreg = SREG;
+	cli();
+	record_len = 0;
+	record_sent = 0;
+	record_truncated = 0;
+	record_put(level);
+	for (i = 0; i < seed_size; i++)
+		record_put(((const uint8_t *)seed)[i]);
+	record_last = systick_ms;
+	record_on = 1;
+	SREG = sreg;
+}
+
+#ifdef TELEMETRY
+
+// Returns number of bytes recorded
+static inline uint16_t record_length() {
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t len = record_len;
+	SREG = sreg;
+	return len;
+}
+
+// Sets number of bytes sent, atomically as record_put reads it in system tick ISR
+static inline void record_set_sent(uint16_t sent) {
+	uint8_t sreg = SREG;
+	cli();
+	record_sent = sent;
+	SREG = sreg;
+}
+
+// Returns recorded byte at offset that was not sent yet
+static inline uint8_t record_byte(uint16_t offset) {
+	return record_log[offset & (RECORD_SIZE - 1)];
+}
+
+// Sends recorded bytes as TELEMETRY_RECORD events while there is room for them
+// (only whole pairs, the last odd byte is sent by record_stop)
+void record_flush() {
+	uint16_t len = record_length();
+	uint16_t i = record_sent;
+	while ((uint16_t)(len - i) >= 2 &&
+			telemetry_try_send(TELEMETRY_RECORD, i, record_byte(i), record_byte(i + 1)))
+		i += 2;
+	record_set_sent(i);
+}
+
+// Stops recording at the end of the session and sends the rest (waits for buffer room)
+void record_stop() {
+	record_on = 0;
+	uint16_t len = record_length();
+	uint16_t i;
+	for (i = record_sent; i < len; i += 2)
+		telemetry_send(TELEMETRY_RECORD, i, record_byte(i), i + 1 < len ? record_byte(i + 1) : 0);
+	record_set_sent(len);
+	len |= (uint16_t)record_truncated << 15;
+	telemetry_send(TELEMETRY_RECORD, RECORD_TRAILER_OFFSET, len, len >> 8);
+}
+
+#else /* TELEMETRY */
+
+// Stops recording at the end of the session
+void record_stop() {
+	record_on = 0;
+}
+
+#endif /* TELEMETRY */
+
+#endif /* RECORD */
@@ -0,0 +1,110 @@
+/******************************************************************************
+ * Recorder of game sessions for deterministic replay.
+ * A session is recorded into record_log in SRAM: game level, PRNG seed of
+ * the game (see rand.h) and then every debounced button edge. An edge is
+ * value (delta << 2 | button) in LEB128 encoding (7 bits per byte, lowest
+ * first, high bit set in all bytes but the last), where delta is the time
+ * since the previous edge in ms and button is 0..3. Delta is exact, as the
+ * game never waits 65 seconds for an edge; an edge takes 2 bytes when delta
+ * is below 4096 ms and 3 bytes otherwise. Edge direction is implied, as
+ * each edge flips its button. A game of level n has n * (n + 1) edges, that
+ * is 1300 bytes at level 25, so the log does not fit into SRAM:
+ * - with TELEMETRY the session is streamed as TELEMETRY_RECORD events while
+ *   it is played (record_flush after every press, the rest at record_stop),
+ *   and record_log is only a ring of RECORD_SIZE bytes not sent yet;
+ * - otherwise record_log keeps the first RECORD_SIZE bytes of the last game
+ *   for a debugger.
+ * When the ring is full recording stops, and the session is truncated.
+ * tools/telemetry.py decodes the stream and saves sessions, which
+ * tools/replay.c feeds back through the firmware on the host simulator.
+ * Define RECORD during compilation to enable it.
+ *****************************************************************************/
+
+#ifndef RECORD_H_
+#define RECORD_H_
+
+#include <avr/io.h>
+
+#include "systick.h"
+
+// Offsets of TELEMETRY_RECORD events with header (seed size, 0) and trailer
+// (log size in 15 bits and truncation flag in bit 15), other events carry
+// two bytes of the log from the offset
+#define RECORD_HEADER_OFFSET  0xffff
+#define RECORD_TRAILER_OFFSET 0xfffe
+#define RECORD_MAX_LEN        0x7fff
+
+#ifdef RECORD
+
+#ifndef RECORD_SIZE
+#define RECORD_SIZE 256
+#endif
+
+#if RECORD_SIZE & (RECORD_SIZE - 1)
+#error RECORD_SIZE must be a power of 2
+#endif
+
+// Recorded session (ring buffer with TELEMETRY), number of bytes recorded and sent
+extern uint8_t record_log[RECORD_SIZE];
+extern volatile uint16_t record_len;
+extern volatile uint16_t record_sent;
+
+// Time of the last recorded edge
+extern uint16_t record_last;
+
+// True while recording, false before the first session or when the log is full
+extern volatile uint8_t record_on;
+
+// True when some edges did not fit into the log
+extern volatile uint8_t record_truncated;
+
+// Appends a byte to the log, must be called with interrupts disabled (e.g. from ISR)
+static inline void record_put(uint8_t b) {
+	uint16_t len = record_len;
+	if ((uint16_t)(len - record_sent) < RECORD_SIZE && len < RECORD_MAX_LEN) {
+		record_log[len & (RECORD_SIZE - 1)] = b;
+		record_len = len + 1;
+	} else {
+		record_on = 0;
+		record_truncated = 1;
+	}
+}
+
+// Records debounced edges of buttons in changed mask, it is called from system tick ISR
+static inline void record_edges(uint8_t changed) {
+	if (!record_on)
+		return;
+	uint16_t ms = systick_ms;
+	uint16_t delta = ms - record_last;
+	record_last = ms;
+	uint8_t button;
+	for (button = 0; button < 4; button++)
+		if (changed & _BV(button)) {
+			uint32_t v = ((uint32_t)delta << 2) | button;
+			delta = 0; // simultaneous edges follow with zero delta
+			for (; v >= 0x80; v >>= 7)
+				record_put(v | 0x80);
+			record_put(v);
+		}
+}
+
+// Starts recording of a new session
+extern void record_start(uint8_t level, const void *seed, uint8_t seed_size);
+
+// Stops recording at the end of the session (and sends the rest with TELEMETRY)
+extern void record_stop();
+
+#else /* RECORD */
+static inline void record_edges(uint8_t changed) {}
+static inline void record_start(uint8_t level, const void *seed, uint8_t seed_size) {}
+static inline void record_stop() {}
+#endif /* RECORD */
+
+#if defined(RECORD) && defined(TELEMETRY)
+// Sends recorded bytes as TELEMETRY_RECORD events while there is room for them
+extern void record_flush();
+#else
+static inline void record_flush() {}
+#endif
+
+#endif /* RECORD_H_ */
@@ -0,0 +1,92 @@
+/******************************************************************************
+ * Interrupt-driven millisecond system tick.
+ *****************************************************************************/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "systick.h"
+#include "buttons.h"
+
+// Milliseconds since systick_init (wraps every 65.5 seconds)
+volatile uint16_t systick_ms;
+
+#ifdef CLOCK_SCALING
+// Clock division factor (as clock_div_t) that gives F_CPU
+uint8_t clock_full_div;
+#endif
+
+// Interrupt Service Routine for timer0 compare match every millisecond
+ISR(TIMER0_COMPA_vect) {
+	uint16_t ms = systick_ms + 1;
+	systick_ms = ms;
+	// debounce buttons
+	if ((uint8_t)ms % DEBOUNCE_TICK_MS == 0)
+		buttons_tick();
+}
+
+// Starts system tick timer
+void systick_init() {
+	// use timer0 in CTC mode with top at one millisecond
+	TCCR0A = _BV(WGM01);
+	OCR0A = SYSTICK_TOP;
+	TCNT0 = 0;
+	TCCR0B = SYSTICK_CS;
+	TIMSK0 = _BV(OCIE0A);
+#ifdef CLOCK_SCALING
+	// full clock is the one set by fuses (CKDIV8 gives 1MHz from 8MHz internal oscillator)
+	clock_full_div = CLKPR & 0x0f;
+	clock_idle();
+#endif
+}
+
+// Sleeps in idle mode until the next interrupt, must be called with interrupts disabled
+// (SEI executes the next instruction before any interrupt, so it cannot be missed before SLEEP)
+static inline void systick_sleep() {
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+	cli();
+}
+
+// Sleeps in idle mode until the next interrupt (at most one millisecond)
+void sleep_idle() {
+	uint8_t sreg = SREG;
+	cli();
+	systick_sleep();
+	SREG = sreg;
+}
+
+// Sleeps in idle mode until millis() reaches deadline
+void sleep_until(uint16_t deadline) {
+	uint8_t sreg = SREG;
+	cli();
+	while ((int16_t)(systick_ms - deadline) < 0)
+		systick_sleep();
+	SREG = sreg;
+}
+
+// Sleeps in power-down mode until any button changes, buzzer must be off
+// (pin change interrupts of buttons are always enabled, see buttons_init)
+void sleep_power_down() {
+	uint8_t sreg = SREG;
+	cli();
+	// changes after this check are not lost, because their pending flags wake CPU up
+	// right after SLEEP, but don't sleep if pins already differ from debounced state
+	// (a press still being debounced)
+	if (get_buttons() == get_stable_buttons()) {
+		set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+		sleep_enable();
+#ifdef BODS
+		sleep_bod_disable(); // no brown-out detector during sleep (ATmega328P only)
+#endif
+		sei();
+		sleep_cpu();
+		sleep_disable();
+		cli();
+	}
+	SREG = sreg;
+}
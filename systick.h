@@ -0,0 +1,113 @@
+/******************************************************************************
+ * Interrupt-driven millisecond system tick.
+ * This code uses 8-bit Timer0 in CTC mode to count milliseconds, so that
+ * timestamps and timeouts do not depend on busy-wait delay loops.
+ * Delays sleep in idle mode until a deadline and stay exact under interrupt load.
+ * Timer0 counter keeps running and can still be used as randomness source.
+ * Define CLOCK_SCALING during compilation to run the CPU at a lower clock
+ * (F_CPU / 2^CLOCK_IDLE_SHIFT) whenever buzzer is off. Timer0 prescaler is
+ * switched together with the CPU clock, so millis() stays exact. The idle
+ * clock must be at least 1 MHz, so that a system tick leaves 1000 cycles for
+ * its ISR and the game loop (1 MHz / 8 would leave only 125), hence it needs
+ * F_CPU of 8 MHz or more. Buzzer switches back to full clock while it plays,
+ * so tones and note lengths are compile-time constants for F_CPU and never
+ * have to be converted at run-time for the idle clock.
+ * Power-down sleep stops all clocks and wakes up on pin change of any button.
+ *****************************************************************************/
+
+#ifndef SYSTICK_H_
+#define SYSTICK_H_
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/power.h>
+
+// Timer0 prescaler, so that one millisecond fits into 8 bits
+#if F_CPU <= 2000000
+#define SYSTICK_PRESCALER 8
+#elif F_CPU <= 16000000
+#define SYSTICK_PRESCALER 64
+#else
+#define SYSTICK_PRESCALER 256
+#endif
+
+// Number of Timer0 ticks in one millisecond (rounded)
+#define SYSTICK_TOP ((uint8_t)((F_CPU / SYSTICK_PRESCALER + 500) / 1000 - 1))
+
+// Timer0 clock select bits for SYSTICK_PRESCALER at full clock, and for
+// SYSTICK_PRESCALER / 2^CLOCK_IDLE_SHIFT at the idle clock
+#if SYSTICK_PRESCALER == 8
+#define SYSTICK_CS       _BV(CS01)
+#define CLOCK_IDLE_SHIFT 3
+#define SYSTICK_IDLE_CS  _BV(CS00)
+#elif SYSTICK_PRESCALER == 64
+#define SYSTICK_CS       (_BV(CS01) | _BV(CS00))
+#define CLOCK_IDLE_SHIFT 3
+#define SYSTICK_IDLE_CS  _BV(CS01)
+#else
+#define SYSTICK_CS       _BV(CS02)
+#define CLOCK_IDLE_SHIFT 2
+#define SYSTICK_IDLE_CS  (_BV(CS01) | _BV(CS00))
+#endif
+
+#if defined(CLOCK_SCALING) && F_CPU / (1 << CLOCK_IDLE_SHIFT) < 1000000
+#error CLOCK_SCALING needs F_CPU of 8 MHz or more (idle clock of at least 1 MHz)
+#endif
+
+// Milliseconds since systick_init (wraps every 65.5 seconds)
+extern volatile uint16_t systick_ms;
+
+// Returns milliseconds since systick_init, compare values only by their difference
+static inline uint16_t millis() {
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t ms = systick_ms;
+	SREG = sreg;
+	return ms;
+}
+
+// Starts system tick timer
+extern void systick_init();
+
+#ifdef CLOCK_SCALING
+// Clock division factor (as clock_div_t) that gives F_CPU
+extern uint8_t clock_full_div;
+
+// Switches CPU to full F_CPU clock (called when buzzer starts)
+static inline void clock_full() {
+	uint8_t sreg = SREG;
+	cli();
+	clock_prescale_set((clock_div_t)clock_full_div);
+	TCCR0B = SYSTICK_CS;
+	SREG = sreg;
+}
+
+// Switches CPU to F_CPU / 2^CLOCK_IDLE_SHIFT clock (called when buzzer stops)
+static inline void clock_idle() {
+	uint8_t sreg = SREG;
+	cli();
+	clock_prescale_set((clock_div_t)(clock_full_div + CLOCK_IDLE_SHIFT));
+	TCCR0B = SYSTICK_IDLE_CS;
+	SREG = sreg;
+}
+#else /* CLOCK_SCALING */
+static inline void clock_full() {}
+static inline void clock_idle() {}
+#endif /* CLOCK_SCALING */
+
+// Sleeps in idle mode until the next interrupt (at most one millisecond)
+extern void sleep_idle();
+
+// Sleeps in idle mode until millis() reaches deadline
+extern void sleep_until(uint16_t deadline);
+
+// Sleeps in idle mode for a specified number of ms (with 1ms tick granularity)
+static inline void sleep_ms(uint16_t ms) {
+	sleep_until(millis() + ms);
+}
+
+// Sleeps in power-down mode until any button changes, buzzer must be off
+// (system tick stops, so millis() does not count the time spent sleeping)
+extern void sleep_power_down();
+
+#endif /* SYSTICK_H_ */
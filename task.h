@@ -0,0 +1,45 @@
+/******************************************************************************
+ * Cooperative tasks in the style of protothreads.
+ * A task is a function that is called over and over from an event loop and
+ * returns TASK_WAITING when it blocks, resuming from the same place on the
+ * next call. Event loops sleep until the next interrupt (system tick, buzzer
+ * or pin change) between rounds, so several tasks run concurrently without
+ * any stacks. Local variables of a task do not survive blocking, keep them
+ * static or in the task structure.
+ *****************************************************************************/
+
+#ifndef TASK_H_
+#define TASK_H_
+
+#include <stdint.h>
+
+#include "systick.h"
+
+// Task state
+typedef struct {
+	uint16_t line;     // source line to resume from, 0 to start from the beginning
+	uint16_t deadline; // millis() when TASK_DELAY finishes
+} task_t;
+
+// Task function results
+#define TASK_WAITING 0
+#define TASK_DONE    1
+
+// Resets task to start from the beginning
+#define TASK_INIT(t)             ((t)->line = 0)
+
+// Starts task body
+#define TASK_BEGIN(t)            switch ((t)->line) { case 0:
+
+// Blocks task until condition is true
+#define TASK_WAIT_UNTIL(t, cond) \
+	do { (t)->line = __LINE__; case __LINE__: if (!(cond)) return TASK_WAITING; } while (0)
+
+// Blocks task for a specified number of ms
+#define TASK_DELAY(t, ms) \
+	do { (t)->deadline = millis() + (ms); TASK_WAIT_UNTIL(t, (int16_t)(millis() - (t)->deadline) >= 0); } while (0)
+
+// Finishes task body, the next call starts it again
+#define TASK_END(t)              } (t)->line = 0; return TASK_DONE
+
+#endif /* TASK_H_ */
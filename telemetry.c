@@ -0,0 +1,143 @@
+/******************************************************************************
+ * Game telemetry over USART TX pin.
+ *****************************************************************************/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "board.h"
+#include "telemetry.h"
+#include "systick.h"
+
+#ifdef TELEMETRY
+
+// Ring buffer of bytes to send, written by telemetry_event and read by USART ISR
+uint8_t telemetry_buffer[TELEMETRY_BUFFER_SIZE];
+volatile uint8_t telemetry_head; // next byte to send (modified by ISR only)
+volatile uint8_t telemetry_tail; // next free byte (modified with interrupts disabled)
+uint8_t telemetry_dropped;       // number of events dropped since the last report
+volatile uint8_t telemetry_requested; // set when a byte is received
+
+// Interrupt Service Routine for empty USART data register
+ISR(MCU_USART_UDRE_vect) {
+	uint8_t head = telemetry_head;
+	MCU_UDR = telemetry_buffer[head];
+	head = (head + 1) & (TELEMETRY_BUFFER_SIZE - 1);
+	telemetry_head = head;
+	if (head == telemetry_tail)
+		MCU_UCSRB &= ~_BV(MCU_UDRIE); // buffer is empty
+}
+
+// Interrupt Service Routine for received byte
+ISR(MCU_USART_RX_vect) {
+	(void)MCU_UDR;
+	telemetry_requested = 1;
+}
+
+// Starts USART transmitter and receiver
+void telemetry_init() {
+	PRR &= ~MCU_PRR_USART;
+	RXD_PORT |= _BV(RXD_BIT); // pull-up on RXD, so that it stays idle when nothing is connected
+	MCU_UBRR = TELEMETRY_UBRR;
+	MCU_UCSRA = _BV(MCU_U2X);
+	MCU_UCSRC = _BV(MCU_UCSZ1) | _BV(MCU_UCSZ0); // 8N1
+	MCU_UCSRB = _BV(MCU_TXEN) | _BV(MCU_RXEN) | _BV(MCU_RXCIE);
+}
+
+// Puts one frame into the buffer at tail, returns new tail
+static inline uint8_t telemetry_put(uint8_t tail, uint8_t type, uint16_t ms, uint8_t a, uint8_t b) {
+	telemetry_buffer[tail] = type;
+	tail = (tail + 1) & (TELEMETRY_BUFFER_SIZE - 1);
+	telemetry_buffer[tail] = ms;
+	tail = (tail + 1) & (TELEMETRY_BUFFER_SIZE - 1);
+	telemetry_buffer[tail] = ms >> 8;
+	tail = (tail + 1) & (TELEMETRY_BUFFER_SIZE - 1);
+	telemetry_buffer[tail] = a;
+	tail = (tail + 1) & (TELEMETRY_BUFFER_SIZE - 1);
+	telemetry_buffer[tail] = b;
+	return (tail + 1) & (TELEMETRY_BUFFER_SIZE - 1);
+}
+
+// Returns number of free bytes in the buffer, must be called with interrupts disabled
+// (one byte is always left free to tell full buffer from empty one)
+static inline uint8_t telemetry_free() {
+	return (telemetry_head - telemetry_tail - 1) & (TELEMETRY_BUFFER_SIZE - 1);
+}
+
+// Puts one frame (and report of dropped events before it) into the buffer and starts sending,
+// must be called with interrupts disabled when there is room for both
+static void telemetry_frame(uint8_t type, uint16_t value, uint8_t a, uint8_t b) {
+	uint8_t tail = telemetry_tail;
+	if (telemetry_dropped) {
+		tail = telemetry_put(tail, TELEMETRY_DROPPED, value, telemetry_dropped, 0);
+		telemetry_dropped = 0;
+	}
+	telemetry_tail = telemetry_put(tail, type, value, a, b);
+	MCU_UCSRB |= _BV(MCU_UDRIE); // start sending if it was idle
+}
+
+// Returns number of bytes needed for the next frame
+static inline uint8_t telemetry_need() {
+	return telemetry_dropped ? 2 * TELEMETRY_FRAME_SIZE : TELEMETRY_FRAME_SIZE;
+}
+
+// Sends an event of a given type with two arguments, drops it when buffer is full
+// It can be called from ISRs, too
+void telemetry_event(uint8_t type, uint8_t a, uint8_t b) {
+	uint8_t sreg = SREG;
+	cli();
+	if (telemetry_free() < telemetry_need()) {
+		if (telemetry_dropped != 0xff)
+			telemetry_dropped++;
+	} else
+		telemetry_frame(type, systick_ms, a, b);
+	SREG = sreg;
+}
+
+// Sends an event of a given type with two arguments and a given timestamp, drops it when buffer is full
+void telemetry_event_at(uint8_t type, uint16_t ms, uint8_t a, uint8_t b) {
+	uint8_t sreg = SREG;
+	cli();
+	if (telemetry_free() < telemetry_need()) {
+		if (telemetry_dropped != 0xff)
+			telemetry_dropped++;
+	} else
+		telemetry_frame(type, ms, a, b);
+	SREG = sreg;
+}
+
+// Sends a frame with a given value instead of timestamp, returns false when buffer is full
+uint8_t telemetry_try_send(uint8_t type, uint16_t value, uint8_t a, uint8_t b) {
+	uint8_t sreg = SREG;
+	cli();
+	uint8_t sent = telemetry_free() >= telemetry_need();
+	if (sent)
+		telemetry_frame(type, value, a, b);
+	SREG = sreg;
+	return sent;
+}
+
+// Sends a frame with a given value instead of timestamp, sleeping while buffer is full
+void telemetry_send(uint8_t type, uint16_t value, uint8_t a, uint8_t b) {
+	uint8_t sreg = SREG;
+	cli();
+	while (telemetry_free() < telemetry_need()) {
+		SREG = sreg;
+		sleep_idle(); // buffer is drained by USART ISR
+		cli();
+	}
+	telemetry_frame(type, value, a, b);
+	SREG = sreg;
+}
+
+// Returns true if a byte was received on RX since the last call
+uint8_t take_telemetry_request() {
+	uint8_t sreg = SREG;
+	cli();
+	uint8_t requested = telemetry_requested;
+	telemetry_requested = 0;
+	SREG = sreg;
+	return requested;
+}
+
+#endif /* TELEMETRY */
@@ -0,0 +1,76 @@
+/******************************************************************************
+ * Game telemetry over USART TX pin.
+ * Events are fixed 5-byte frames: type, millis() timestamp (little-endian),
+ * and two argument bytes. Type bytes have TELEMETRY_SYNC in their high
+ * nibble, so a decoder can find frame boundaries in the middle of a stream.
+ * Frames are put into a ring buffer that is sent by the USART data register
+ * empty interrupt. An event that does not fit into the buffer is dropped and
+ * counted, so telemetry never blocks the game; the number of dropped events
+ * is reported with TELEMETRY_DROPPED as soon as there is room again.
+ * Any byte received on RX pin is a request that the game takes when idle.
+ * Define TELEMETRY during compilation to enable it (8N1, TELEMETRY_BAUD).
+ * Decode the stream on a host with tools/telemetry.py.
+ *****************************************************************************/
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <avr/io.h>
+
+// Event types (high nibble is TELEMETRY_SYNC)
+#define TELEMETRY_SYNC    0xa0
+#define TELEMETRY_DROPPED 0xa0 // count of dropped events (saturates at 255), 0
+#define TELEMETRY_START   0xa1 // game level, entropy bits (see entropy.h)
+#define TELEMETRY_STEP    0xa2 // position from 0, button 0..3
+#define TELEMETRY_PRESS   0xa3 // buttons mask (0 on timeout), 0 (stamped at debounced press)
+#define TELEMETRY_RESULT  0xa4 // WINNER (1) or LOSER (0), game level
+#define TELEMETRY_LATENCY 0xa5 // latency kind, field (value instead of timestamp, see latency.h)
+#define TELEMETRY_RECORD  0xa6 // two bytes of session log (offset instead of timestamp, see record.h)
+
+#ifdef TELEMETRY
+
+#ifdef CLOCK_SCALING
+#error TELEMETRY needs constant CPU clock for USART baud rate, do not use with CLOCK_SCALING
+#endif
+
+#ifndef TELEMETRY_BAUD
+#define TELEMETRY_BAUD 9600
+#endif
+
+// USART baud rate register value in double speed mode (rounded)
+#define TELEMETRY_UBRR ((uint16_t)((F_CPU / 8.0 / TELEMETRY_BAUD) + 0.5) - 1)
+
+// Size of the transmit buffer (must be a power of 2)
+#define TELEMETRY_BUFFER_SIZE 64
+
+// Size of an event frame in bytes
+#define TELEMETRY_FRAME_SIZE 5
+
+// Starts USART transmitter
+extern void telemetry_init();
+
+// Sends an event of a given type with two arguments, drops it when buffer is full
+extern void telemetry_event(uint8_t type, uint8_t a, uint8_t b);
+
+// Sends an event of a given type with two arguments and a given timestamp, drops it when buffer is full
+extern void telemetry_event_at(uint8_t type, uint16_t ms, uint8_t a, uint8_t b);
+
+// Sends a frame with a given value instead of timestamp, returns false when buffer is full
+extern uint8_t telemetry_try_send(uint8_t type, uint16_t value, uint8_t a, uint8_t b);
+
+// Sends a frame with a given value instead of timestamp, sleeping while buffer is full
+extern void telemetry_send(uint8_t type, uint16_t value, uint8_t a, uint8_t b);
+
+// Returns true if a byte was received on RX since the last call
+extern uint8_t take_telemetry_request();
+
+#else /* TELEMETRY */
+static inline void telemetry_init() {}
+static inline void telemetry_event(uint8_t type, uint8_t a, uint8_t b) {}
+static inline void telemetry_event_at(uint8_t type, uint16_t ms, uint8_t a, uint8_t b) {}
+static inline uint8_t telemetry_try_send(uint8_t type, uint16_t value, uint8_t a, uint8_t b) { return 0; }
+static inline void telemetry_send(uint8_t type, uint16_t value, uint8_t a, uint8_t b) {}
+static inline uint8_t take_telemetry_request() { return 0; }
+#endif /* TELEMETRY */
+
+#endif /* TELEMETRY_H_ */
@@ -0,0 +1,26 @@
+/******************************************************************************
+ * Minimal checks for host tests (see Makefile, make test).
+ * CHECK prints failed condition with its location and counts it, a test
+ * returns TEST_RESULT() from main, that is non-zero when anything failed.
+ *****************************************************************************/
+
+#ifndef TEST_H_
+#define TEST_H_
+
+#include <stdio.h>
+
+static int test_failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		test_failures++; \
+		fprintf(stderr, "%s:%d: check failed: %s: ", __FILE__, __LINE__, #cond); \
+		fprintf(stderr, __VA_ARGS__); \
+		fputc('\n', stderr); \
+	} \
+} while (0)
+
+#define TEST_RESULT(name) \
+	(printf("%s: %s\n", name, test_failures ? "FAILED" : "ok"), test_failures != 0)
+
+#endif /* TEST_H_ */
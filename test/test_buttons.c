@@ -0,0 +1,190 @@
+/******************************************************************************
+ * Host test of button debouncing with injected contact bounce.
+ * buttons_tick is fed sample by sample and compared with a reference model
+ * of the documented behavior: a button flips after 4 consecutive samples
+ * that differ from its debounced state, bounce and glitches never add
+ * edges, and edges stay latched until they are taken. Then the system tick
+ * on the simulator shows that a press is debounced within 8 ms.
+ *****************************************************************************/
+
+#include <stdlib.h>
+
+#include "test.h"
+#include "sim.h"
+#include "buttons.h"
+
+// Samples that a button must differ from its debounced state to flip
+#define DEBOUNCE_SAMPLES 4
+
+// Feeds one raw sample of buttons to buttons_tick
+static void sample(uint8_t raw) {
+	sim_set_buttons(raw);
+	buttons_tick();
+}
+
+// Takes both edge latches, returns pressed mask in low and released in high nibble
+static uint8_t take_edges() {
+	uint8_t pressed = take_pressed_buttons();
+	return pressed | (take_released_buttons() << 4);
+}
+
+// Exactly DEBOUNCE_SAMPLES differing samples flip a button, fewer do not
+static void check_samples() {
+	uint8_t n;
+	uint8_t i;
+	for (n = 1; n <= 6; n++) {
+		for (i = 0; i < n; i++)
+			sample(2);
+		sample(0); // back to released
+		uint8_t edges = take_edges();
+		if (n < DEBOUNCE_SAMPLES)
+			CHECK(edges == 0, "%u samples gave edges %02x", n, edges);
+		else
+			CHECK(edges == 0x02, "%u samples gave edges %02x", n, edges);
+		for (i = 0; i < 8; i++)
+			sample(0);
+		take_edges();
+		CHECK(buttons_state == 0, "state %x after release", buttons_state);
+	}
+	// flip happens exactly on the 4th sample
+	for (i = 1; i <= DEBOUNCE_SAMPLES; i++) {
+		sample(8);
+		CHECK((buttons_state == 8) == (i == DEBOUNCE_SAMPLES), "state %x after %u samples", buttons_state, i);
+	}
+	for (i = 0; i < DEBOUNCE_SAMPLES; i++)
+		sample(0);
+	take_edges();
+}
+
+// Edges are latched until taken, even when the button is released meanwhile
+static void check_latching() {
+	uint8_t i;
+	for (i = 0; i < DEBOUNCE_SAMPLES; i++)
+		sample(1 | 4);
+	for (i = 0; i < DEBOUNCE_SAMPLES; i++)
+		sample(0);
+	CHECK(buttons_state == 0, "state %x", buttons_state);
+	CHECK(has_pressed_buttons(), "press is latched");
+	uint8_t edges = take_edges();
+	CHECK(edges == 0x55, "edges %02x", edges);
+	edges = take_edges();
+	CHECK(edges == 0, "edges %02x are taken twice", edges);
+	CHECK(!has_pressed_buttons(), "press is still latched after it was taken");
+}
+
+// Physical buttons with random bounce after every change and random glitches,
+// compared with the reference model sample by sample
+static void check_bounce() {
+	uint8_t phys = 0;           // physical state of buttons
+	uint8_t model = 0;          // debounced state of the model
+	uint8_t cnt[4] = { 0 };     // differing samples counted by the model
+	uint32_t next[4] = { 0 };   // next physical change of each button
+	uint32_t bounce_end[4] = { 0 }; // end of bounce after the last change
+	uint32_t changes[4] = { 0 };
+	uint32_t edges[4] = { 0 };
+	uint32_t late = 0;
+	uint32_t t;
+	uint8_t b;
+	srand(2010);
+	for (t = 0; t < 400000; t++) {
+		uint8_t raw = 0;
+		for (b = 0; b < 4; b++) {
+			uint8_t bit = 1 << b;
+			if (t == next[b]) {
+				phys ^= bit;
+				changes[b]++;
+				bounce_end[b] = t + rand() % DEBOUNCE_SAMPLES;  // 0..3 samples of bounce
+				next[b] = bounce_end[b] + 2 * DEBOUNCE_SAMPLES + rand() % 40;
+			}
+			uint8_t v = phys & bit;
+			if (t < bounce_end[b])
+				v = rand() & 1 ? bit : 0;                     // contact bounce
+			else if (t >= bounce_end[b] + DEBOUNCE_SAMPLES && rand() % 50 == 0)
+				v ^= bit;                                      // single-sample glitch
+			raw |= v;
+		}
+		sample(raw);
+		uint8_t flipped = 0;
+		for (b = 0; b < 4; b++) {
+			uint8_t bit = 1 << b;
+			if ((raw ^ model) & bit) {
+				if (++cnt[b] == DEBOUNCE_SAMPLES) {
+					flipped |= bit;
+					cnt[b] = 0;
+				}
+			} else
+				cnt[b] = 0;
+			if (flipped & bit) {
+				edges[b]++;
+				if (t > bounce_end[b] + DEBOUNCE_SAMPLES - 1)
+					late++;
+			}
+		}
+		model ^= flipped;
+		CHECK(buttons_state == model, "sample %u: state %x, model %x", t, buttons_state, model);
+		if (buttons_state != model)
+			return;
+		uint8_t taken = take_edges();
+		uint8_t expect = (model & flipped) | ((~model & flipped) << 4);
+		CHECK(taken == expect, "sample %u: edges %02x, model %02x", t, taken, expect);
+	}
+	for (b = 0; b < 4; b++)
+		CHECK(edges[b] == changes[b] || edges[b] + 1 == changes[b],
+			"button %u: %u edges for %u changes", b, edges[b], changes[b]);
+	CHECK(late == 0, "%u edges later than 4 samples after bounce", late);
+}
+
+// Time of a raw press on the simulator and when it was debounced (in virtual ms)
+static uint64_t press_at;
+static uint64_t debounced_at;
+
+static void hook(void) {
+	uint64_t ms = sim_ms();
+	if (ms == press_at)
+		sim_set_buttons(1);
+	if (!debounced_at && get_stable_buttons())
+		debounced_at = ms;
+}
+
+// System tick samples every DEBOUNCE_TICK_MS, so a press is debounced
+// DEBOUNCE_SAMPLES - 1 to DEBOUNCE_SAMPLES sampling periods after it
+static void check_timing() {
+	uint8_t phase;
+	sim_reset();
+	sim_ms_hook = hook;
+	systick_init();
+	for (phase = 0; phase < DEBOUNCE_TICK_MS; phase++) {
+		sim_set_buttons(0);
+		sleep_ms(20);
+		take_edges();
+		debounced_at = 0;
+		press_at = sim_ms() + 10 + phase;
+#ifdef LATENCY
+		latency_edge_ms = 0;
+#endif
+		while (!debounced_at)
+			sleep_idle();
+		uint64_t lat = debounced_at - press_at;
+		CHECK(lat > (DEBOUNCE_SAMPLES - 1) * DEBOUNCE_TICK_MS && lat <= DEBOUNCE_SAMPLES * DEBOUNCE_TICK_MS,
+			"press at phase %u debounced after %llu ms", phase, (unsigned long long)lat);
+#ifdef LATENCY
+		// the first raw sample of the press is stamped for latency measurement
+		uint16_t first = latency_edge_ms - (uint16_t)(press_at - 1);
+		CHECK(first > 0 && first <= DEBOUNCE_TICK_MS, "latency edge %u ms after press", first);
+#endif
+#ifdef TELEMETRY
+		// the debounced press is stamped for telemetry
+		CHECK(get_pressed_ms() == (uint16_t)(debounced_at - 1), "press stamped at %u, debounced at %llu ms",
+			get_pressed_ms(), (unsigned long long)debounced_at);
+#endif
+	}
+}
+
+int main() {
+	sim_reset();
+	check_samples();
+	check_latching();
+	check_bounce();
+	check_timing();
+	return TEST_RESULT("test_buttons");
+}
@@ -0,0 +1,112 @@
+/******************************************************************************
+ * Host test of buzzer precision: every game tone and note length is played
+ * on the simulator and must be within 0.5% of its nominal frequency and
+ * length, the winner sweep within 0.8% of its half periods (see buzzer.h).
+ * The average pitch of the default Timer1 backend is exact with the
+ * fractional part of tones, so it must be within 0.01%.
+ * It also reports CPU time of button notes: buzzer interrupts per note and
+ * their cycles (by sim_cycles), that compares the backends.
+ * make test runs it at 1, 8, 12, 16 and 20 MHz for each backend.
+ *****************************************************************************/
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "sim.h"
+#include "simon.h"
+
+#define LEN_ERROR_PCT   0.5
+#define SWEEP_ERROR_PCT 0.8
+
+#ifdef BUZZER_TIMER2
+#define BACKEND "timer2"
+#define TONE_ERROR_PCT  0.5
+static const uint16_t T2_PRESCALER[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+#else
+#define BACKEND "timer1"
+#define TONE_ERROR_PCT  0.01 // average of all half periods of a note
+#endif
+
+// Worst errors (in %) found
+static double worst_tone;
+static double worst_len;
+static double worst_sweep;
+
+// Buzzer interrupts, their cycles and time of the 5 notes played (4 buttons and loser)
+static uint32_t note_irqs;
+static uint64_t note_cycles;
+static uint64_t note_time;
+
+// Returns half period of the tone being played right now (in clock cycles)
+static double current_half_period() {
+#ifdef BUZZER_TIMER2
+	return (OCR2A + 1.0) * T2_PRESCALER[TCCR2B & 7];
+#else
+	return OCR1A + 1.0;
+#endif
+}
+
+// Plays a note from tone, frac, cnt triple and checks its frequency and length
+static void check_note(const char *name, double freq, double len_ms, uint16_t tone, uint8_t frac, uint16_t cnt) {
+	uint32_t irqs = sim_stats.timer1;
+	uint64_t isr_cycles = sim_stats.isr_cycles - sim_stats.timer0 * (uint64_t)sim_cycles.timer0;
+	uint64_t start = sim_time;
+	start_buzzer(tone, frac, cnt);
+#ifdef BUZZER_TIMER2
+	double half = current_half_period();
+#endif
+	wait_buzzer();
+	uint64_t cycles = sim_time - start;
+#ifndef BUZZER_TIMER2
+	double half = (double)cycles / (sim_stats.timer1 - irqs); // one interrupt per half period
+#endif
+	double tone_err = fabs(F_CPU / 2.0 / half / freq - 1) * 100;
+	double len_err = fabs(cycles * 1000.0 / F_CPU / len_ms - 1) * 100;
+	CHECK(tone_err <= TONE_ERROR_PCT, "%s %.2f Hz is off by %.3f%%", name, freq, tone_err);
+	CHECK(len_err <= LEN_ERROR_PCT, "%s %.0f ms is off by %.3f%%", name, len_ms, len_err);
+	if (tone_err > worst_tone)
+		worst_tone = tone_err;
+	if (len_err > worst_len)
+		worst_len = len_err;
+	irqs = sim_stats.timer1 - irqs;
+#ifdef BUZZER_TIMER2
+	CHECK(irqs == 1, "%s %.2f Hz took %u interrupts", name, freq, irqs); // only at the end of note
+#endif
+	note_irqs += irqs;
+	note_cycles += sim_stats.isr_cycles - sim_stats.timer0 * (uint64_t)sim_cycles.timer0 - isr_cycles;
+	note_time += cycles;
+}
+
+int main() {
+	static const double BUTTON_FREQ[4] = { 440.00, 880.00, 587.33, 784.00 };
+	uint8_t button;
+	uint16_t us;
+
+	sim_reset();
+	hal_init();
+
+	// button tones (BUTTONS table in flash) and loser tone
+	for (button = 0; button < 4; button++) {
+		const uint16_t *btc = &BUTTONS[3 * button];
+		check_note("button", BUTTON_FREQ[button], BUTTON_LENGTH_MS, btc[0], btc[1], btc[2]);
+	}
+	check_note("loser", 333.33, 250, FREQLEN2TONECNT(333.33, 250));
+	CHECK(TCCR2A == 0 && TCCR2B == (_BV(CS22) | _BV(CS21)), "timer2 left in TCCR2A=%x TCCR2B=%x",
+		TCCR2A, TCCR2B); // counts 0..255 for random
+
+	// winner sweep of half periods from 250us down to 71us (see play_winner)
+	for (us = 250; us > 70; us--) {
+		start_buzzer(US2TONE(us), 0, 6);
+		double err = fabs(current_half_period() / (us * (F_CPU / 1000000.0)) - 1) * 100;
+		stop_buzzer();
+		CHECK(err <= SWEEP_ERROR_PCT, "sweep %u us is off by %.3f%%", us, err);
+		if (err > worst_sweep)
+			worst_sweep = err;
+	}
+
+	printf("%s %2u MHz: tone %.3f%%, length %.3f%%, sweep %.3f%%; a note takes %u interrupts, "
+		"%llu cycles (%.2f%% of CPU)\n", BACKEND, (unsigned)(F_CPU / 1000000), worst_tone, worst_len,
+		worst_sweep, note_irqs / 5, (unsigned long long)(note_cycles / 5), 100.0 * note_cycles / note_time);
+	return TEST_RESULT("test_buzzer");
+}
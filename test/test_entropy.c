@@ -0,0 +1,159 @@
+/******************************************************************************
+ * Host test of the entropy pool: how many distinct first games do boards
+ * get right after power-up? Each board boots in a fresh process, a player
+ * presses a button (with contact bounce) to start a game, and the seed and
+ * health of the first game are collected:
+ * - human timing (press within seconds) must give as many distinct games as
+ *   random 16-bit values would (the first seed gets at most ENTROPY_POOL_BITS
+ *   from the pool, so about 8 of 1000 boards share a game) and credit it;
+ * - presses in the same millisecond of every boot must still give mostly
+ *   distinct games from their phase within the millisecond;
+ * - presses at the same clock cycle give the same game every time (health
+ *   is still credited, as it only sees changes within a boot).
+ * make test runs it with 1000 boards, pass a number of boards to run more.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "test.h"
+#include "sim.h"
+#include "simon.h"
+
+#define BOARDS 1000
+
+// Timing of the start press of a board (in clock cycles)
+typedef struct {
+	uint64_t press;
+	uint64_t hold;
+} start_t;
+
+// The first game of a board
+typedef struct {
+	uint32_t seed;
+	uint8_t health;
+} first_t;
+
+// State of host generator of player timing (see sim_rand)
+static uint64_t host_state = 0x5eed;
+
+// Schedules a change of buttons with a few bounces in 500 us before it
+static void bounce(uint8_t from, uint8_t to, uint64_t at) {
+	uint64_t step = SIM_MS / 2 / 8;
+	uint8_t i;
+	for (i = 0; i < 3; i++) {
+		sim_set_buttons_at(to, at + 2 * i * step);
+		sim_set_buttons_at(from, at + (2 * i + 1) * step);
+	}
+	sim_set_buttons_at(to, at + 6 * step);
+}
+
+// Boots a board in this process and starts the first game
+static first_t boot(start_t start) {
+	first_t first;
+	sim_reset();
+	hal_init();
+	bounce(0, 1, start.press);
+	bounce(1, 0, start.press + start.hold);
+	wait_start();
+	play_start();
+	new_game_sequence();
+	memset(&first, 0, sizeof(first));
+	memcpy(&first.seed, &game_seed, sizeof(game_seed));
+	first.health = game_health;
+	return first;
+}
+
+// Boots a board in a child process, as the firmware expects fresh variables
+static first_t boot_fresh(start_t start) {
+	first_t first;
+	int fd[2];
+	if (pipe(fd) != 0)
+		exit(2);
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(fd[0]);
+		first = boot(start);
+		_exit(write(fd[1], &first, sizeof(first)) != sizeof(first));
+	}
+	close(fd[1]);
+	if (read(fd[0], &first, sizeof(first)) != sizeof(first))
+		exit(2);
+	close(fd[0]);
+	waitpid(pid, NULL, 0);
+	return first;
+}
+
+static int cmp_seed(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Boots boards with timing from a generator, returns the number of distinct first games
+static int run(const char *name, int boards, start_t (*timing)(void), uint8_t *min_health) {
+	uint32_t *seeds = malloc(boards * sizeof(uint32_t));
+	int i;
+	*min_health = 0xff;
+	for (i = 0; i < boards; i++) {
+		first_t first = boot_fresh(timing());
+		seeds[i] = first.seed;
+		if (first.health < *min_health)
+			*min_health = first.health;
+	}
+	qsort(seeds, boards, sizeof(uint32_t), cmp_seed);
+	int distinct = boards > 0;
+	for (i = 1; i < boards; i++)
+		distinct += seeds[i] != seeds[i - 1];
+	free(seeds);
+	printf("%s: %d distinct first games of %d boards, health at least %u bits\n",
+		name, distinct, boards, *min_health);
+	return distinct;
+}
+
+// Player presses within 0.5..3 seconds after power-up and holds for 80..200 ms
+static start_t human(void) {
+	start_t s;
+	s.press = SIM_MS * 500 + sim_rand(&host_state) % (SIM_MS * 2500);
+	s.hold = SIM_MS * 80 + sim_rand(&host_state) % (SIM_MS * 120);
+	return s;
+}
+
+// Player presses and releases in the same milliseconds of every boot
+static start_t same_ms(void) {
+	start_t s;
+	s.press = SIM_MS * 1000 + sim_rand(&host_state) % SIM_MS;
+	s.hold = SIM_MS * 100 + sim_rand(&host_state) % SIM_MS;
+	return s;
+}
+
+// Player presses and releases at the same clock cycles of every boot
+static start_t same_cycle(void) {
+	start_t s;
+	s.press = SIM_MS * 1000 + SIM_MS / 3;
+	s.hold = SIM_MS * 100 + SIM_MS / 3;
+	return s;
+}
+
+int main(int argc, char **argv) {
+	int boards = argc > 1 ? atoi(argv[1]) : BOARDS;
+	uint8_t health;
+	int distinct;
+
+	distinct = run("human timing", boards, human, &health);
+	double shared = boards * (boards - 1.0) / 2 / (1UL << ENTROPY_POOL_BITS); // expected collisions
+	CHECK(distinct >= boards - 2 * shared - 4, "%d of %d first games are distinct, %.1f shared expected",
+		distinct, boards, shared);
+	CHECK(health >= 2, "health %u bits", health);
+
+	// phase within a millisecond at 8 us resolution of Timer0 (1 MHz) is all that differs
+	distinct = run("same milliseconds", boards, same_ms, &health);
+	CHECK(distinct >= boards * 9 / 10, "%d of %d first games are distinct", distinct, boards);
+
+	distinct = run("same clock cycles", boards, same_cycle, &health);
+	CHECK(distinct == 1, "%d first games from the same timing", distinct);
+	return TEST_RESULT("test_entropy");
+}
@@ -0,0 +1,214 @@
+/******************************************************************************
+ * Host test of game sequences for a RAND_BACKEND (see rand.h).
+ * Millions of games are generated by the firmware itself, each one from the
+ * seed of the previous game mixed with fresh timer bytes as the game does,
+ * and their buttons are checked for uniformity (chi-square per position and
+ * over all of them), for runs of the same button (longest run per game
+ * against its exact distribution) and for serial correlation (consecutive
+ * buttons of a game and first buttons of consecutive games).
+ * Any statistic with p-value below MIN_P fails the test. A 16-bit generator
+ * is tested with no more games than it has.
+ * make test runs it for each backend, pass a number of games to run more.
+ *****************************************************************************/
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "sim.h"
+#include "simon.h"
+
+#define GAMES     1000000
+#define LENGTH    LEVEL_4_BUTTONS // buttons in a game (the longest one)
+#define MAX_RUN   8               // the last bin of longest runs is MAX_RUN or more
+#define MIN_P     1e-4
+
+// 16-bit generator has only 65535 distinct games, more of them repeat the same ones
+// (1000000 games show their bias, e.g. 37% fewer longest runs of 8 or more)
+#if RAND_BACKEND == RAND_XORSHIFT16
+#define MAX_GAMES 65535
+#else
+#define MAX_GAMES LONG_MAX
+#endif
+
+// State of host generator of timer bytes (see sim_rand), independent of the tested one
+static uint64_t host_state = 0x5eed;
+
+// Regularized upper incomplete gamma function Q(a, x)
+static double gamma_q(double a, double x) {
+	double lg = a * log(x) - x - lgamma(a);
+	int i;
+	if (x < a + 1) { // series for P(a, x)
+		double sum = 1 / a;
+		double term = sum;
+		for (i = 1; i < 1000; i++) {
+			term *= x / (a + i);
+			sum += term;
+			if (term < sum * 1e-15)
+				break;
+		}
+		return 1 - sum * exp(lg);
+	}
+	// continued fraction for Q(a, x) (modified Lentz)
+	double b = x + 1 - a;
+	double c = 1e300;
+	double d = 1 / b;
+	double h = d;
+	for (i = 1; i < 1000; i++) {
+		double an = -i * (i - a);
+		b += 2;
+		d = an * d + b;
+		if (fabs(d) < 1e-300) d = 1e-300;
+		c = b + an / c;
+		if (fabs(c) < 1e-300) c = 1e-300;
+		d = 1 / d;
+		double del = d * c;
+		h *= del;
+		if (fabs(del - 1) < 1e-15)
+			break;
+	}
+	return exp(lg) * h;
+}
+
+// Checks observed counts against expected ones with chi-square test, returns p-value
+static double chi_square(const char *name, const uint64_t *obs, const double *exp_cnt, int n) {
+	double chi = 0;
+	int i;
+	for (i = 0; i < n; i++) {
+		double d = obs[i] - exp_cnt[i];
+		chi += d * d / exp_cnt[i];
+	}
+	double p = gamma_q((n - 1) / 2.0, chi / 2);
+	CHECK(p >= MIN_P, "%s: chi-square %.2f with %d degrees of freedom, p=%.2g", name, chi, n - 1, p);
+	return p;
+}
+
+// Probabilities of the longest run of the same button in a game of LENGTH buttons
+static void longest_run_probs(double *prob) {
+	// dist[k][r] is probability that the longest run is k and the last one is r
+	static double dist[LENGTH + 1][LENGTH + 1];
+	static double next[LENGTH + 1][LENGTH + 1];
+	int i, k, r;
+	dist[1][1] = 1;
+	for (i = 1; i < LENGTH; i++) {
+		for (k = 0; k <= LENGTH; k++)
+			for (r = 0; r <= LENGTH; r++)
+				next[k][r] = 0;
+		for (k = 1; k <= i; k++)
+			for (r = 1; r <= k; r++) {
+				next[k][1] += dist[k][r] * 0.75;
+				next[k > r ? k : r + 1][r + 1] += dist[k][r] * 0.25;
+			}
+		for (k = 0; k <= LENGTH; k++)
+			for (r = 0; r <= LENGTH; r++)
+				dist[k][r] = next[k][r];
+	}
+	for (k = 0; k < MAX_RUN; k++)
+		prob[k] = 0;
+	for (k = 1; k <= LENGTH; k++)
+		for (r = 1; r <= k; r++)
+			prob[(k < MAX_RUN ? k : MAX_RUN) - 1] += dist[k][r];
+}
+
+// Checks correlation of values with their pairs, returns z-score of coefficient
+static double correlation(const char *name, const uint64_t *pairs) {
+	double n = 0, sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+	int x, y;
+	for (x = 0; x < 4; x++)
+		for (y = 0; y < 4; y++) {
+			double c = pairs[4 * x + y];
+			n += c;
+			sx += c * x;
+			sy += c * y;
+			sxx += c * x * x;
+			syy += c * y * y;
+			sxy += c * x * y;
+		}
+	double r = (n * sxy - sx * sy) / sqrt((n * sxx - sx * sx) * (n * syy - sy * sy));
+	double z = r * sqrt(n);
+	CHECK(fabs(z) < 4, "%s: correlation %.5f (z=%.2f)", name, r, z);
+	return z;
+}
+
+static uint64_t positions[LENGTH][4]; // buttons at each position
+static uint64_t pairs[16];            // consecutive buttons of a game
+static uint64_t firsts[16];           // first buttons of consecutive games
+static uint64_t runs[MAX_RUN];        // longest runs of games
+
+int main(int argc, char **argv) {
+	long games = argc > 1 ? atol(argv[1]) : GAMES;
+	if (games > MAX_GAMES)
+		games = MAX_GAMES;
+	long g;
+	int i;
+	uint8_t prev_first = 0;
+	for (g = 0; g < games; g++) {
+		TCNT0 = sim_rand(&host_state) >> 56;
+		TCNT2 = sim_rand(&host_state) >> 56;
+		new_game_sequence();
+		game_position = LENGTH;
+		game_iter_t it;
+		game_iter_start(&it);
+		uint8_t prev = 0;
+		uint8_t run = 0;
+		uint8_t longest = 0;
+		for (i = 0; i < LENGTH; i++) {
+			uint8_t button = game_iter_next(&it);
+			positions[i][button]++;
+			if (i == 0) {
+				if (g > 0)
+					firsts[4 * prev_first + button]++;
+				prev_first = button;
+			} else
+				pairs[4 * prev + button]++;
+			run = i > 0 && button == prev ? run + 1 : 1;
+			if (run > longest)
+				longest = run;
+			prev = button;
+		}
+		runs[(longest < MAX_RUN ? longest : MAX_RUN) - 1]++;
+	}
+
+	// uniformity of buttons at each position and over all of them
+	char name[64];
+	uint64_t all[4] = { 0 };
+	double expect[16];
+	double worst = 1;
+	for (i = 0; i < 4; i++)
+		expect[i] = games / 4.0;
+	for (i = 0; i < LENGTH; i++) {
+		int b;
+		for (b = 0; b < 4; b++)
+			all[b] += positions[i][b];
+		snprintf(name, sizeof(name), "buttons at position %d", i);
+		double p = chi_square(name, positions[i], expect, 4);
+		if (p < worst)
+			worst = p;
+	}
+	for (i = 0; i < 4; i++)
+		expect[i] = games * (double)LENGTH / 4;
+	double p_all = chi_square("all buttons", all, expect, 4);
+
+	// longest runs of the same button
+	double prob[MAX_RUN];
+	longest_run_probs(prob);
+	for (i = 0; i < MAX_RUN; i++)
+		expect[i] = games * prob[i];
+	double p_runs = chi_square("longest runs", runs, expect, MAX_RUN);
+
+	// serial correlation inside games and between consecutive games
+	for (i = 0; i < 16; i++)
+		expect[i] = games * (LENGTH - 1) / 16.0;
+	double p_pairs = chi_square("consecutive buttons", pairs, expect, 16);
+	double z_pairs = correlation("consecutive buttons", pairs);
+	for (i = 0; i < 16; i++)
+		expect[i] = (games - 1) / 16.0;
+	double p_firsts = chi_square("first buttons of consecutive games", firsts, expect, 16);
+	double z_firsts = correlation("first buttons of consecutive games", firsts);
+
+	printf("backend %d, %ld games of %d buttons: p-values positions %.3g (worst), all %.3g, "
+		"runs %.3g, pairs %.3g (z=%.2f), games %.3g (z=%.2f)\n",
+		RAND_BACKEND, games, LENGTH, worst, p_all, p_runs, p_pairs, z_pairs, p_firsts, z_firsts);
+	return TEST_RESULT("test_rand");
+}
@@ -0,0 +1,151 @@
+/******************************************************************************
+ * Host test of session recording: a player who watches the leds repeats
+ * every sequence of a game up to LEVEL_4_BUTTONS, the session is streamed
+ * as TELEMETRY_RECORD events while it is played and is decoded from the
+ * USART output again. It must be complete and keep the time of every edge
+ * (deltas over 4 seconds take 3 bytes). The session is saved for make test
+ * to replay it with tools/replay.c (see Makefile).
+ *****************************************************************************/
+
+#include <stdlib.h>
+
+#include "test.h"
+#include "sim.h"
+#include "simon.h"
+
+#define REACTION_MS 400
+#define HOLD_MS     120
+#define MAX_EDGES   (LEVEL_4_BUTTONS * (LEVEL_4_BUTTONS + 1))
+
+// Player: leds seen lit in this round, the next button to press and when
+static uint8_t leds_was;
+static uint8_t flashes;
+static uint8_t step;
+static uint64_t press_at;
+static uint64_t release_at;
+static game_iter_t player_it;
+
+// Raw changes of buttons made by the player (virtual ms and button)
+static uint64_t raw_ms[MAX_EDGES];
+static uint8_t raw_button[MAX_EDGES];
+static uint16_t raws;
+
+static void raw_change(uint8_t mask, uint8_t button) {
+	sim_set_buttons(mask);
+	if (raws < MAX_EDGES) {
+		raw_ms[raws] = sim_ms();
+		raw_button[raws] = button;
+		raws++;
+	}
+}
+
+static void hook(void) {
+	uint64_t ms = sim_ms();
+	uint8_t leds = sim_leds();
+	// playback of the round is over when all of its leds went off
+	if (!leds && leds_was && !press_at && !release_at && ++flashes == game_position) {
+		game_iter_start(&player_it);
+		press_at = ms + REACTION_MS;
+	}
+	leds_was = leds;
+	if (press_at && ms == press_at) {
+		step = game_iter_next(&player_it);
+		raw_change(_BV(step), step);
+		press_at = 0;
+		release_at = ms + HOLD_MS;
+	}
+	if (release_at && ms == release_at) {
+		raw_change(0, step);
+		release_at = 0;
+		if (game_iter_has_next(&player_it))
+			press_at = ms + HOLD_MS + REACTION_MS; // after the tone of this press
+		else
+			flashes = (uint8_t)-1; // led of this tone goes off before the next round
+	}
+}
+
+// Session decoded from USART output
+static uint8_t log_bytes[RECORD_MAX_LEN];
+static uint16_t log_len;
+static int log_header;
+static int log_truncated;
+static int log_missing;
+
+static void decode_tx(void) {
+	uint32_t i;
+	for (i = 0; i + 5 <= sim_tx_len; i += 5) {
+		if (sim_tx[i] != TELEMETRY_RECORD)
+			continue;
+		uint16_t offset = sim_tx[i + 1] | (sim_tx[i + 2] << 8);
+		uint8_t a = sim_tx[i + 3];
+		uint8_t b = sim_tx[i + 4];
+		if (offset == RECORD_HEADER_OFFSET) {
+			log_header = a == sizeof(game_seed);
+			log_len = 0;
+		} else if (offset == RECORD_TRAILER_OFFSET) {
+			uint16_t size = (a | (b << 8)) & RECORD_MAX_LEN;
+			log_truncated = (b & 0x80) != 0;
+			log_missing |= size > log_len;
+			log_len = size;
+		} else {
+			log_missing |= offset != log_len;
+			log_bytes[offset] = a;
+			log_bytes[offset + 1] = b;
+			log_len = offset + 2;
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	sim_reset();
+	sim_ms_hook = hook;
+	hal_init();
+	game_level = LEVEL_4_BUTTONS;
+	new_game_sequence();
+	uint8_t result = play_game();
+	record_stop();
+	sleep_ms(100); // USART sends the trailer
+	CHECK(result == WINNER && game_position == LEVEL_4_BUTTONS, "result %u at position %u",
+		result, game_position);
+
+	decode_tx();
+	CHECK(log_header && !log_truncated && !log_missing, "header %d, truncated %d, missing %d",
+		log_header, log_truncated, log_missing);
+	CHECK(log_bytes[0] == LEVEL_4_BUTTONS, "level %u", log_bytes[0]);
+
+	// debounced edges are the raw ones with the same button, 6 to 8 ms later
+	uint16_t i = 1 + sizeof(game_seed);
+	uint16_t n = 0;
+	uint16_t long_edges = 0;
+	uint64_t t = 0;
+	uint64_t t_prev = 0;
+	while (i < log_len && n < raws) {
+		uint32_t v = 0;
+		uint8_t shift = 0;
+		uint16_t start = i;
+		do {
+			v |= (uint32_t)(log_bytes[i] & 0x7f) << shift;
+			shift += 7;
+		} while (log_bytes[i++] & 0x80);
+		if (i - start == 3)
+			long_edges++;
+		t += v >> 2;
+		if (n > 0) {
+			int64_t lag = (int64_t)(t - t_prev) - (int64_t)(raw_ms[n] - raw_ms[n - 1]);
+			CHECK(lag >= -2 && lag <= 2, "edge %u is %lld ms off", n, (long long)lag);
+		}
+		t_prev = t;
+		CHECK((v & 3) == raw_button[n], "edge %u of button %u instead of %u", n, v & 3, raw_button[n]);
+		n++;
+	}
+	CHECK(n == MAX_EDGES && raws == MAX_EDGES && i == log_len, "%u edges recorded, %u made, %u of %u bytes",
+		n, raws, i, log_len);
+	CHECK(long_edges > 0, "no edge took 3 bytes");
+	printf("recorded %u edges in %u bytes, %u of them took 3 bytes\n", n, log_len, long_edges);
+
+	if (argc > 1) {
+		FILE *f = fopen(argv[1], "wb");
+		CHECK(f && fwrite(log_bytes, 1, log_len, f) == log_len && fclose(f) == 0, "cannot save %s", argv[1]);
+	}
+	return TEST_RESULT("test_record");
+}
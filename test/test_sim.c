@@ -0,0 +1,213 @@
+/******************************************************************************
+ * Host test of the simulator itself: system tick, buzzer note length,
+ * debounced buttons and EEPROM log run on virtual time as on a board, and
+ * cycles of interrupts and main program split it into active and sleeping
+ * time of CPU, which gives standby current and wake-up latency of power-down
+ * (wait_start restarts its chase pattern after a touch). Writes of set_leds to the ports are counted by hardware
+ * breakpoints of the host (Linux perf events), the check is skipped where
+ * they are not allowed.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/hw_breakpoint.h>
+#include <linux/perf_event.h>
+
+#include "test.h"
+#include "sim.h"
+#include "simon.h"
+
+// Leds seen by the hook and milliseconds they were lit
+static uint8_t leds_seen;
+static uint32_t leds_ms;
+
+// Scripted buttons: press at press_ms for hold_ms (virtual time)
+static uint64_t press_ms;
+static uint64_t hold_ms;
+static uint8_t press_mask;
+
+// Leds are watched from this virtual time, and the first time they were seen lit
+static uint64_t watch_from;
+static uint64_t watch_lit;
+
+static void hook(void) {
+	uint8_t leds = sim_leds();
+	leds_seen |= leds;
+	if (leds)
+		leds_ms++;
+	if (leds && watch_from && sim_time >= watch_from && !watch_lit)
+		watch_lit = sim_time;
+	uint64_t ms = sim_ms();
+	if (press_mask && ms == press_ms)
+		sim_set_buttons(press_mask);
+	if (press_mask && ms == press_ms + hold_ms)
+		sim_set_buttons(0);
+}
+
+// Opens a counter of writes to a byte by this process (disabled), returns -1 when
+// the host does not allow hardware breakpoints
+static int write_counter(volatile uint8_t *addr) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_BREAKPOINT;
+	attr.size = sizeof(attr);
+	attr.bp_type = HW_BREAKPOINT_W;
+	attr.bp_addr = (uintptr_t)addr;
+	attr.bp_len = HW_BREAKPOINT_LEN_1;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Checks that set_leds lights every mask with one write to each port, so all leds
+// change at once (the compiler must not split read-modify-write of a port)
+static void check_set_leds(void) {
+	int fd1 = write_counter(&BOARD_PORT(1));
+	int fd2 = write_counter(&BOARD_PORT(2));
+	if (fd1 < 0 || fd2 < 0) {
+		printf("set_leds: writes to ports not counted, no hardware breakpoints\n");
+		if (fd1 >= 0)
+			close(fd1);
+		return;
+	}
+	uint8_t mask;
+	for (mask = 0; mask < 16; mask++) {
+		uint64_t writes1 = 0;
+		uint64_t writes2 = 0;
+		ioctl(fd1, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd2, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd1, PERF_EVENT_IOC_ENABLE, 0);
+		ioctl(fd2, PERF_EVENT_IOC_ENABLE, 0);
+		set_leds(mask);
+		ioctl(fd1, PERF_EVENT_IOC_DISABLE, 0);
+		ioctl(fd2, PERF_EVENT_IOC_DISABLE, 0);
+		CHECK(read(fd1, &writes1, sizeof(writes1)) == sizeof(writes1) &&
+			read(fd2, &writes2, sizeof(writes2)) == sizeof(writes2), "read of write counters");
+		CHECK(writes1 == 1 && writes2 == 1, "set_leds(%x) wrote ports %llu and %llu times", mask,
+			(unsigned long long)writes1, (unsigned long long)writes2);
+		CHECK(sim_leds() == mask, "set_leds(%x) lit %x", mask, sim_leds());
+	}
+	set_leds(0);
+	close(fd1);
+	close(fd2);
+}
+
+int main() {
+	sim_reset();
+	sim_ms_hook = hook;
+	hal_init();
+	check_set_leds();
+
+	// system tick counts virtual milliseconds
+	sleep_ms(1000);
+	CHECK(systick_ms == 1000, "systick_ms=%u", systick_ms);
+	CHECK(sim_time == 1000ULL * (SYSTICK_TOP + 1) * SYSTICK_PRESCALER, "sim_ms=%llu", (unsigned long long)sim_ms());
+	CHECK(sim_stats.timer0 == 1000, "timer0=%u", sim_stats.timer0);
+
+	// every tick is charged with its ISR and the main program of sleep_until
+	CHECK(sim_stats.isr_cycles == 1000ULL * sim_cycles.timer0, "isr_cycles=%llu",
+		(unsigned long long)sim_stats.isr_cycles);
+	CHECK(sim_stats.cycles == sim_stats.isr_cycles + (uint64_t)sim_stats.sleeps * sim_cycles.wake,
+		"cycles=%llu", (unsigned long long)sim_stats.cycles);
+	CHECK(sim_stats.active_time + sim_stats.idle_time + sim_stats.down_time == sim_cpu_time(),
+		"time split %llu + %llu + %llu", (unsigned long long)sim_stats.active_time,
+		(unsigned long long)sim_stats.idle_time, (unsigned long long)sim_stats.down_time);
+	printf("idle second: %llu cycles, CPU busy %.2f%%, %.0f uA\n", (unsigned long long)sim_stats.cycles,
+		100.0 * sim_stats.active_time / sim_time, sim_stats.charge / (sim_time / (double)F_CPU));
+
+	// a button tone lights its led for the length of the note
+	uint64_t start = sim_time;
+	button_tone(2);
+	double len = (sim_time - start) * 1000.0 / F_CPU;
+	CHECK(len > 149.0 && len < 151.0, "tone length=%.3f ms", len);
+	CHECK(leds_seen == LED2, "leds=%x", leds_seen);
+	CHECK(leds_ms >= 149 && leds_ms <= 151, "led on for %u ms", leds_ms);
+#ifndef BUZZER_TIMER2
+	CHECK(sim_stats.timer1 > 100, "timer1=%u", sim_stats.timer1);
+#endif
+	CHECK(!is_buzzer_working() && sim_leds() == 0, "buzzer and leds off");
+
+	// a debounced press and release is taken by wait_buttons
+	press_ms = sim_ms() + 50;
+	hold_ms = 120;
+	press_mask = 8;
+	uint8_t mask = wait_buttons(1000);
+	CHECK(mask == 8, "wait_buttons=%x", mask);
+	CHECK(sim_ms() >= press_ms + hold_ms, "returned at %llu ms", (unsigned long long)sim_ms());
+
+	// nothing pressed times out
+	press_mask = 0;
+	uint16_t ms = millis();
+	mask = wait_buttons(300);
+	CHECK(mask == 0 && (uint16_t)(millis() - ms) == 300, "timeout mask=%x after %u ms",
+		mask, (uint16_t)(millis() - ms));
+
+	// EEPROM log is written in background and found again
+	eelog_record_t rec;
+	CHECK(!eelog_init(&rec), "erased EEPROM has no records");
+	eelog_save(7, 3);
+	start = sim_ms();
+	while (is_eelog_busy())
+		sleep_idle();
+	CHECK(sim_stats.ee_writes == sizeof(eelog_record_t), "ee_writes=%u", sim_stats.ee_writes);
+	CHECK(sim_ms() - start >= 3 * 3, "EEPROM writes took %llu ms", (unsigned long long)(sim_ms() - start));
+	CHECK(eelog_init(&rec) && rec.level == 7 && rec.best == 3, "level=%u best=%u", rec.level, rec.best);
+
+	// power-down stops system tick until a button changes
+	ms = systick_ms;
+	press_ms = sim_ms() + 5000;
+	hold_ms = 100;
+	press_mask = 1;
+	uint64_t down_time = sim_stats.down_time;
+	double charge = sim_stats.charge;
+	sleep_power_down();
+	CHECK(sim_ms() == press_ms, "woke up at %llu ms", (unsigned long long)sim_ms());
+	CHECK(systick_ms == ms, "systick_ms=%u counted %u ms in power-down", systick_ms, ms);
+	down_time = sim_stats.down_time - down_time;
+	CHECK(down_time > 4999 * SIM_MS && down_time <= 5000 * SIM_MS, "%llu cycles in power-down",
+		(unsigned long long)down_time);
+
+	// standby current, and wake-up latency from the pin change to the code after sleep
+	// (oscillator start-up and pin change ISR)
+	double standby_ua = (sim_stats.charge - charge) / (down_time / (double)F_CPU);
+	double wake_us = (sim_cpu_time() - press_ms * SIM_MS) * 1000000.0 / F_CPU;
+	CHECK(standby_ua < 1, "standby current %.2f uA", standby_ua);
+	CHECK(wake_us < 100, "wake-up latency %.0f us", wake_us);
+	printf("power-down: standby %.2f uA, wake-up in %.0f us\n", standby_ua, wake_us);
+
+	// a press still being debounced does not power down
+	sleep_ms(200);
+	take_pressed_buttons();
+	press_mask = 0;
+	sim_set_buttons(4);
+	unsigned power_down = sim_stats.power_down;
+	sleep_power_down();
+	CHECK(sim_stats.power_down == power_down, "powered down during debounce");
+	sleep_ms(20);
+	CHECK(take_pressed_buttons() == 4, "press during debounce is taken");
+	sim_set_buttons(0);
+	sleep_ms(100);
+
+	// wait_start powers down when nobody plays, a touch shorter than debounce wakes it up
+	// and restarts the chase pattern (checked by the hook every ms), then a press starts
+	press_mask = 0;
+	uint64_t touch = sim_time + (IDLE_TIMEOUT_MS + 10000) * SIM_MS + SIM_MS / 3;
+	sim_set_buttons_at(2, touch);
+	sim_set_buttons_at(0, touch + 2 * SIM_MS);
+	sim_set_buttons_at(2, touch + 1000 * SIM_MS);
+	sim_set_buttons_at(0, touch + 1120 * SIM_MS);
+	power_down = sim_stats.power_down;
+	watch_from = touch;
+	wait_start();
+	CHECK(sim_stats.power_down == power_down + 1, "wait_start powered down %u times",
+		sim_stats.power_down - power_down);
+	double chase_ms = (watch_lit - touch) / (double)SIM_MS;
+	CHECK(watch_lit && chase_ms < 5, "chase pattern restarted %.2f ms after touch", chase_ms);
+	CHECK(sim_time >= touch + 1120 * SIM_MS, "wait_start returned at %llu ms", (unsigned long long)sim_ms());
+	printf("power-down: chase pattern restarts within %.2f ms after touch (hook sees leds every ms)\n", chase_ms);
+	return TEST_RESULT("test_sim");
+}
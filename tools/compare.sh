@@ -0,0 +1,94 @@
+#!/bin/sh
+# Compares code generated from two revisions of Simon firmware: section sizes
+# and disassembly of every function, for each board, MCU and configuration of
+# the build matrix. Exits with 1 when anything differs.
+# Usage: tools/compare.sh <base revision> [<revision>]
+# The second revision is the working tree by default, BOARDS, MCUS and CONFIGS
+# may be set to narrow the matrix (a revision without board.h builds its only
+# board whatever BOARD is). Only the avr-gcc matrix proves that size and cycle
+# counts are the same. HOST=1 compares host builds instead (against host/avr
+# shim headers of the working tree): they are compiled for another instruction
+# set and with other I/O registers, so they prove nothing about AVR code and
+# only show that a change does not reach the code at all when they are the
+# same. So far the declarative board.h was compared with the baseline this way
+# only, its AVR equivalence is not proven until the avr-gcc matrix is run.
+
+set -e
+
+if [ $# -lt 1 ]; then
+	echo "Usage: $0 <base revision> [<revision>]" >&2
+	exit 2
+fi
+
+BOARDS=${BOARDS:-"BOARD_SPARKFUN"}
+MCUS=${MCUS:-"atmega168 atmega328p"}
+CONFIGS=${CONFIGS:-"-DF_CPU=1000000
+-DF_CPU=1000000 -DTELEMETRY -DLATENCY -DRECORD
+-DF_CPU=1000000 -DBUZZER_TIMER2
+-DF_CPU=8000000 -DCLOCK_SCALING
+-DF_CPU=16000000 -DRAND_BACKEND=1 -DBUZZER_TIMER2"}
+
+root=$(git rev-parse --show-toplevel)
+out=$root/build/compare
+rm -rf "$out"
+mkdir -p "$out"
+
+# Extracts revision $1 into directory $2 (working tree when $1 is empty)
+extract() {
+	mkdir -p "$2"
+	if [ -z "$1" ]; then
+		(cd "$root" && git ls-files -z --cached --others --exclude-standard | xargs -0 tar -cf -) | tar -xf - -C "$2"
+	else
+		git -C "$root" archive "$1" | tar -xf - -C "$2"
+	fi
+}
+
+# Compiles every source of tree $1 with options $2 for MCU $3, and writes
+# normalized disassembly (no addresses and raw bytes) and sizes into $4
+build() {
+	: > "$4.dis"
+	: > "$4.size"
+	for src in "$1"/*.c; do
+		obj=$4.$(basename "$src" .c).o
+		if [ -n "$HOST" ]; then
+			cc -std=gnu99 -O2 -w -funsigned-char -I"$root/host" -I"$1" $2 -c -o "$obj" "$src"
+			objdump=objdump
+			size=size
+		else
+			avr-gcc -mmcu=$3 -std=gnu99 -Os -w -funsigned-char -funsigned-bitfields \
+				-fpack-struct -fshort-enums -ffunction-sections $2 -c -o "$obj" "$src"
+			objdump=avr-objdump
+			size=avr-size
+		fi
+		$objdump -d --no-show-raw-insn "$obj" | sed -n '/>:$/,$p' |
+			sed -e 's/^ *[0-9a-f]*:[[:space:]]*//' -e 's/^[0-9a-f]* </</' >> "$4.dis"
+		$size "$obj" | tail -1 | awk -v f="$(basename "$src")" '{ print f, $1, $2, $3 }' >> "$4.size"
+	done
+}
+
+extract "$1" "$out/a"
+extract "$2" "$out/b"
+
+[ -n "$HOST" ] && MCUS=host
+newline='
+'
+for board in $BOARDS; do
+for mcu in $MCUS; do
+	IFS=$newline
+	for config in $CONFIGS; do
+		unset IFS
+		name=$(echo "$board $mcu $config" | tr -c 'A-Za-z0-9_=\n' '_')
+		build "$out/a" "-DBOARD=$board $config" $mcu "$out/$name.a"
+		build "$out/b" "-DBOARD=$board $config" $mcu "$out/$name.b"
+		if cmp -s "$out/$name.a.dis" "$out/$name.b.dis" && cmp -s "$out/$name.a.size" "$out/$name.b.size"; then
+			echo "same     $board $mcu $config"
+		else
+			echo "DIFFERS  $board $mcu $config"
+			diff "$out/$name.a.size" "$out/$name.b.size" | sed 's/^/    /' || true
+			diff -u "$out/$name.a.dis" "$out/$name.b.dis" | head -40 | sed 's/^/    /' || true
+			touch "$out/differs"
+		fi
+	done
+done
+done
+[ ! -f "$out/differs" ]
@@ -0,0 +1,465 @@
+/******************************************************************************
+ * Monte Carlo harness for tuning levels and timeouts: plays many games of the
+ * firmware on the host simulator with scripted bot players and reports games
+ * per second, the distribution of rounds reached and how often games are
+ * lost by timeout, the average supply current and energy of MCU per game
+ * from the cycle and sleep accounting of the simulator (see sim_cycles), which
+ * follows the clock set by CLKPR (compare builds with and without
+ * OPTIONS=-DCLOCK_SCALING), and EEPROM bytes written per game with the
+ * projected lifetime of the EEPROM log.
+ * Every session of games runs on a fresh virtual board (a forked process, as
+ * the firmware expects fresh variables) with erased EEPROM, and plays its
+ * games one after another as main does: restore_game at power-up, then for
+ * every game the bot presses start buttons, and wait_start, play_start,
+ * single_game (with wait_buttons and test_game_sequence) and end_game (with
+ * its tones and save of level and high score) run on virtual time, so a game
+ * of minutes takes milliseconds. The bot watches
+ * the leds, counts the flashes of the playback and repeats the sequence. Its
+ * reaction time (from a led going off to the press) and hold time are
+ * lognormal, and it presses a wrong button with a probability that grows
+ * with the length of the sequence.
+ * Sessions are spread over worker processes with a work-stealing pool: each
+ * worker takes sessions from the front of its own range and, when it is
+ * empty, steals the upper half of the largest range of another worker. Every
+ * game gets its own bot generator from its number, so the results do not
+ * depend on the number of workers.
+ * Build it with the options of the board: make montecarlo OPTIONS=...
+ * (e.g. OPTIONS=-DPRESS_TIMEOUT_MS=2000 to tune the timeout).
+ * Usage: montecarlo [-n games] [-j workers] [-G games per session] [-b start buttons 1..4]
+ *        [-r reaction ms] [-s reaction sigma] [-H hold ms]
+ *        [-e error] [-g error per button] [-S seed]
+ *****************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "sim.h"
+#include "simon.h"
+
+// Games never take this long, a board is stopped as failed after it (in ms)
+#define GAME_LIMIT_MS 3600000
+
+// Spread of hold time (sigma of its logarithm)
+#define HOLD_SIGMA 0.3
+
+// Rated write cycles of each EEPROM cell, and bytes of the ring that the log spreads writes over
+#define EEPROM_ENDURANCE 100000.0
+#define EELOG_BYTES      (EELOG_RECORDS * sizeof(eelog_record_t))
+
+// Options of a run
+typedef struct {
+	long games;
+	int workers;
+	int session;           // games played by a board in a row (EEPROM is kept between them)
+	int start_buttons;     // number of buttons pressed to start a game (selects level)
+	double reaction_ms;    // median reaction time
+	double reaction_sigma; // sigma of its logarithm
+	double hold_ms;        // median time a button is held
+	double error;          // probability of a wrong press
+	double error_growth;   // added to it for every button of the sequence
+	uint64_t seed;
+} config_t;
+
+static config_t config = { 10000, 0, 10, 4, 450, 0.35, 120, 0.002, 0.0005, 1 };
+
+// How a game ended
+#define OUTCOME_FAILED  0 // board crashed or hit GAME_LIMIT_MS
+#define OUTCOME_WON     1
+#define OUTCOME_ERROR   2 // lost by a wrong press
+#define OUTCOME_TIMEOUT 3 // lost without a wrong press (no press or release in time)
+#define OUTCOMES        4
+
+// Result of a game, written by its board into shared memory
+typedef struct {
+	uint8_t outcome;
+	uint8_t level;
+	uint8_t position; // round reached
+	uint16_t presses; // presses of the bot during the game
+	uint32_t ms;      // virtual duration of the game
+	uint64_t active;  // time CPU ran during the game (in F_CPU cycles)
+	uint64_t down;    // time it spent in power-down
+	double charge;    // supply charge of MCU during the game in uC
+	uint16_t ee_writes; // bytes written into EEPROM after the game
+} result_t;
+
+static result_t *results;
+
+/*---------------------------------------------------------------------------*
+  BOT PLAYER
+ *---------------------------------------------------------------------------*/
+
+// State of host generator of the bot (see sim_rand)
+static uint64_t bot_state;
+
+// Returns uniform value in [0, 1)
+static double bot_uniform(void) {
+	return (sim_rand(&bot_state) >> 11) * 0x1.0p-53;
+}
+
+// Returns lognormal time in ms (at least 1) with a given median
+static uint64_t bot_time(double median, double sigma) {
+	double u = 1 - bot_uniform(); // (0, 1] for log
+	double z = sqrt(-2 * log(u)) * cos(2 * M_PI * bot_uniform());
+	double t = median * exp(sigma * z);
+	return t < 1 ? 1 : (uint64_t)(t + 0.5);
+}
+
+typedef enum {
+	BOT_IDLE,    // does not play
+	BOT_WATCH,   // counts flashes of the playback
+	BOT_PRESS,   // presses the next button at bot_at
+	BOT_RELEASE, // releases it at bot_at
+	BOT_TONE     // waits for the tone of the press to end
+} bot_mode_t;
+
+static bot_mode_t bot;
+static uint8_t bot_leds;     // leds lit in the previous ms
+static uint8_t bot_flashes;  // flashes of the playback seen in this round
+static uint8_t bot_wrong;    // true when the bot pressed a wrong button
+static uint16_t bot_presses;
+static uint64_t bot_at;      // virtual ms of the next press or release
+static game_iter_t bot_it;   // game sequence as the bot remembers it
+
+// Schedules the next press after reaction time
+static void bot_react(uint64_t ms) {
+	bot_at = ms + bot_time(config.reaction_ms, config.reaction_sigma);
+	bot = BOT_PRESS;
+}
+
+// Plays the game, it is called once per virtual millisecond
+static void bot_hook(void) {
+	uint64_t ms = sim_ms();
+	uint8_t leds = sim_leds();
+	uint8_t off = bot_leds && !leds; // a flash of the playback or a tone is over
+	bot_leds = leds;
+	switch (bot) {
+	case BOT_WATCH:
+		if (off && ++bot_flashes == game_position) {
+			game_iter_start(&bot_it);
+			bot_react(ms);
+		}
+		break;
+	case BOT_PRESS:
+		if (ms >= bot_at) {
+			uint8_t button = game_iter_next(&bot_it);
+			if (bot_uniform() < config.error + config.error_growth * game_position) {
+				button = (button + 1 + sim_rand(&bot_state) % 3) & 3;
+				bot_wrong = 1;
+			}
+			sim_set_buttons(_BV(button));
+			bot_presses++;
+			bot_at = ms + bot_time(config.hold_ms, HOLD_SIGMA);
+			bot = BOT_RELEASE;
+		}
+		break;
+	case BOT_RELEASE:
+		if (ms >= bot_at) {
+			sim_set_buttons(0);
+			bot = bot_wrong ? BOT_IDLE : BOT_TONE; // the game is lost after a wrong press
+		}
+		break;
+	case BOT_TONE:
+		if (off) {
+			if (game_iter_has_next(&bot_it)) {
+				bot_react(ms);
+			} else {
+				bot_flashes = 0; // the next round is played back after a pause
+				bot = BOT_WATCH;
+			}
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+// Plays game number g on the board of its session, saved is the record that
+// end_game compares level and high score with
+static void play(uint32_t g, result_t *r, eelog_record_t *saved) {
+	bot_state = (config.seed << 32) ^ g;
+	bot_state = sim_rand(&bot_state); // games get unrelated generators
+	sim_limit = sim_time + GAME_LIMIT_MS * SIM_MS;
+	bot = BOT_IDLE;
+
+	// start buttons are pressed within 0.5..2.5 seconds after power-up
+	uint64_t at = sim_time + 500 * SIM_MS + sim_rand(&bot_state) % (2000 * SIM_MS);
+	sim_set_buttons_at(_BV(config.start_buttons) - 1, at);
+	sim_set_buttons_at(0, at + bot_time(config.hold_ms, HOLD_SIGMA) * SIM_MS);
+	wait_start();
+	play_start();
+
+	bot_leds = sim_leds();
+	bot_flashes = 0;
+	bot_wrong = 0;
+	bot_presses = 0;
+	bot = BOT_WATCH;
+	uint64_t start = sim_time;
+	sim_stats_t before = sim_stats;
+	uint8_t result = single_game();
+	r->outcome = result ? OUTCOME_WON : bot_wrong ? OUTCOME_ERROR : OUTCOME_TIMEOUT;
+	r->level = game_level;
+	r->position = game_position;
+	r->presses = bot_presses;
+	r->ms = (sim_time - start) / SIM_MS;
+	r->active = sim_stats.active_time - before.active_time;
+	r->down = sim_stats.down_time - before.down_time;
+	r->charge = sim_stats.charge - before.charge;
+	bot = BOT_IDLE;
+	end_game(result, saved);
+	// the record is written behind while the next game would start, wait for all of it
+	while (is_eelog_busy())
+		sleep_idle();
+	r->ee_writes = sim_stats.ee_writes - before.ee_writes;
+}
+
+// Plays games of session number s on a fresh board in this process
+static void play_session(uint32_t s) {
+	eelog_record_t saved;
+	uint64_t g = (uint64_t)s * config.session;
+	uint64_t end = g + config.session < (uint64_t)config.games ? g + config.session : config.games;
+	sim_reset();
+	hal_init();
+	restore_game(&saved);
+	bot = BOT_IDLE;
+	sim_ms_hook = bot_hook;
+	for (; g < end; g++)
+		play(g, &results[g], &saved);
+}
+
+/*---------------------------------------------------------------------------*
+  WORK-STEALING POOL
+ *---------------------------------------------------------------------------*/
+
+// Worker in shared memory, its range of sessions is packed as next | end << 32
+typedef struct {
+	uint64_t range;
+	uint64_t sessions;
+	uint64_t steals;
+} __attribute__ ((aligned(64))) worker_t;
+
+static worker_t *pool;
+
+static inline uint64_t range_pack(uint32_t next, uint32_t end) {
+	return next | (uint64_t)end << 32;
+}
+
+// Takes the next session from the front of own range, returns false when it is empty
+static int take(worker_t *w, uint32_t *g) {
+	uint64_t r = __atomic_load_n(&w->range, __ATOMIC_ACQUIRE);
+	do {
+		uint32_t next = r;
+		uint32_t end = r >> 32;
+		if (next >= end)
+			return 0;
+		*g = next;
+	} while (!__atomic_compare_exchange_n(&w->range, &r, range_pack(*g + 1, r >> 32),
+		0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+	return 1;
+}
+
+// Moves the upper half of the largest range of another worker into the empty
+// range of w, returns false when no worker has more than one session left
+static int steal(worker_t *w) {
+	worker_t *victim = NULL;
+	uint32_t most = 1;
+	int i;
+	for (i = 0; i < config.workers; i++) {
+		uint64_t r = __atomic_load_n(&pool[i].range, __ATOMIC_ACQUIRE);
+		uint32_t left = (uint32_t)(r >> 32) - (uint32_t)r;
+		if (left > most) {
+			most = left;
+			victim = &pool[i];
+		}
+	}
+	if (!victim)
+		return 0;
+	uint64_t r = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+	uint32_t next = r;
+	uint32_t end = r >> 32;
+	if (end - next < 2)
+		return 1; // it was taken meanwhile, look again
+	uint32_t mid = end - (end - next) / 2;
+	if (__atomic_compare_exchange_n(&victim->range, &r, range_pack(next, mid),
+			0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&w->range, range_pack(mid, end), __ATOMIC_RELEASE);
+		w->steals++;
+	}
+	return 1;
+}
+
+// Plays sessions of the pool until there are none left (games of a failed session
+// that are not over keep OUTCOME_FAILED of zeroed results)
+static void work(worker_t *w) {
+	uint32_t s;
+	while (1) {
+		if (!take(w, &s)) {
+			if (!steal(w))
+				return;
+			continue;
+		}
+		pid_t pid = fork();
+		if (pid == 0) {
+			play_session(s);
+			_exit(0);
+		}
+		if (pid > 0)
+			waitpid(pid, NULL, 0);
+		w->sessions++;
+	}
+}
+
+// Allocates zeroed memory shared with forked processes
+static void *shared(size_t size) {
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		exit(2);
+	}
+	return p;
+}
+
+/*---------------------------------------------------------------------------*
+  REPORT
+ *---------------------------------------------------------------------------*/
+
+static void report(double seconds) {
+	uint64_t outcomes[OUTCOMES] = { 0 };
+	uint64_t rounds[MAX_GAME_LEVEL + 1] = { 0 };
+	uint64_t presses = 0;
+	uint64_t virtual_ms = 0;
+	uint64_t active = 0;
+	uint64_t down = 0;
+	double charge = 0;
+	uint64_t ee_writes = 0;
+	uint64_t steals = 0;
+	uint8_t level = 0;
+	int max_round = 0;
+	long g;
+	int i;
+	for (g = 0; g < config.games; g++) {
+		result_t *r = &results[g];
+		outcomes[r->outcome]++;
+		if (r->outcome == OUTCOME_FAILED)
+			continue;
+		rounds[r->position]++;
+		if (r->position > max_round)
+			max_round = r->position;
+		if (r->level > level)
+			level = r->level;
+		presses += r->presses;
+		virtual_ms += r->ms;
+		active += r->active;
+		down += r->down;
+		charge += r->charge;
+		ee_writes += r->ee_writes;
+	}
+	for (i = 0; i < config.workers; i++)
+		steals += pool[i].steals;
+	uint64_t played = config.games - outcomes[OUTCOME_FAILED];
+
+	printf("%ld games of level %u (%d start buttons) by %d workers, %llu steals\n",
+		config.games, level, config.start_buttons, config.workers, (unsigned long long)steals);
+	printf("bot: reaction %.0f ms (sigma %.2f), hold %.0f ms, error %.2f%% + %.2f%% per button; "
+		"press timeout %u ms\n", config.reaction_ms, config.reaction_sigma, config.hold_ms,
+		config.error * 100, config.error_growth * 100, PRESS_TIMEOUT_MS);
+	printf("speed: %.0f games/s, %.0f virtual seconds per second (%.2f s)\n",
+		config.games / seconds, virtual_ms / 1000.0 / seconds, seconds);
+	if (!played)
+		return;
+	printf("won %.2f%%, lost by error %.2f%%, lost by timeout %.2f%% (timeout hit %.3f%% of waits for a press)\n",
+		100.0 * outcomes[OUTCOME_WON] / played, 100.0 * outcomes[OUTCOME_ERROR] / played,
+		100.0 * outcomes[OUTCOME_TIMEOUT] / played,
+		100.0 * outcomes[OUTCOME_TIMEOUT] / (presses + outcomes[OUTCOME_TIMEOUT]));
+	printf("mean game %.1f s, %.1f presses\n", virtual_ms / 1000.0 / played, (double)presses / played);
+	double game_cycles = virtual_ms * (double)SIM_MS;
+	printf("MCU: %.0f uA average in a game (CPU active %.2f%%, power-down %.2f%%), %.0f uC, "
+		"%.1f mJ at %.1f V per game\n", charge * 1000 / virtual_ms, 100 * active / game_cycles,
+		100 * down / game_cycles, charge / played, charge * SIM_VCC / 1000 / played, SIM_VCC);
+	double writes = (double)ee_writes / played;
+	printf("EEPROM: %.2f bytes written per game (sessions of %d games), lifetime ", writes, config.session);
+	if (writes > 0)
+		printf("%.1f million games\n", EEPROM_ENDURANCE * EELOG_BYTES / writes / 1e6);
+	else
+		printf("unlimited\n");
+	printf("round    games    share  reached\n");
+	uint64_t reached = played;
+	for (i = 1; i <= max_round; i++) {
+		printf("%5d %8llu %7.2f%% %7.2f%%\n", i, (unsigned long long)rounds[i],
+			100.0 * rounds[i] / played, 100.0 * reached / played);
+		reached -= rounds[i];
+	}
+}
+
+int main(int argc, char **argv) {
+	int opt;
+	while ((opt = getopt(argc, argv, "n:j:G:b:r:s:H:e:g:S:")) != -1) {
+		switch (opt) {
+		case 'n': config.games = atol(optarg); break;
+		case 'j': config.workers = atoi(optarg); break;
+		case 'G': config.session = atoi(optarg); break;
+		case 'b': config.start_buttons = atoi(optarg); break;
+		case 'r': config.reaction_ms = atof(optarg); break;
+		case 's': config.reaction_sigma = atof(optarg); break;
+		case 'H': config.hold_ms = atof(optarg); break;
+		case 'e': config.error = atof(optarg); break;
+		case 'g': config.error_growth = atof(optarg); break;
+		case 'S': config.seed = strtoull(optarg, NULL, 0); break;
+		default:
+			fprintf(stderr, "Usage: %s [-n games] [-j workers] [-G games per session] [-b start buttons 1..4] "
+				"[-r reaction ms] [-s reaction sigma] [-H hold ms] [-e error] "
+				"[-g error per button] [-S seed]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (config.games < 1 || config.games > UINT32_MAX || config.session < 1 ||
+			config.start_buttons < 1 || config.start_buttons > 4) {
+		fprintf(stderr, "%s: games and session must be positive and start buttons 1..4\n", argv[0]);
+		return 2;
+	}
+	if (config.workers < 1)
+		config.workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (config.workers < 1)
+		config.workers = 1;
+
+	// sessions are split evenly, workers that are done earlier steal the rest
+	uint64_t sessions = (config.games + config.session - 1) / config.session;
+	results = shared(config.games * sizeof(result_t));
+	pool = shared(config.workers * sizeof(worker_t));
+	int i;
+	for (i = 0; i < config.workers; i++)
+		pool[i].range = range_pack(sessions * i / config.workers, sessions * (i + 1) / config.workers);
+
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	fflush(stdout);
+	for (i = 0; i < config.workers; i++) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return 2;
+		}
+		if (pid == 0) {
+			work(&pool[i]);
+			_exit(0);
+		}
+	}
+	while (wait(NULL) > 0)
+		;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	report((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+	long failed = 0;
+	long g;
+	for (g = 0; g < config.games; g++)
+		failed += results[g].outcome == OUTCOME_FAILED;
+	if (failed) {
+		fprintf(stderr, "%ld games failed\n", failed);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,150 @@
+/******************************************************************************
+ * Replays recorded game sessions (see record.h) through the firmware on the
+ * host simulator. Level and seed of a session start the game, and every
+ * recorded button edge is fed back as a raw change of pins half a tick
+ * before the system tick that sees it 4 times by its debounced edge. The
+ * replayed game is recorded again and must give the same session, byte
+ * for byte, so a session from a board (tools/telemetry.py --save) shows
+ * that the board and the firmware here agree on every step of the game.
+ * Build it with the options of the board: make replay OPTIONS=...
+ * Usage: replay <session.rec>...
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "sim.h"
+#include "simon.h"
+
+#if !defined(RECORD) || defined(CLOCK_SCALING)
+#error replay needs RECORD and constant clock
+#endif
+
+// Debounced edge comes on the 4th sample, samples are DEBOUNCE_TICK_MS apart
+#define EDGE_TICKS (3 * DEBOUNCE_TICK_MS)
+
+// Button changes are scheduled this far ahead (sim_set_buttons_at has a short queue)
+#define SCHEDULE_MS 20
+
+// Clock cycles per system tick
+#define TICK ((uint64_t)(SYSTICK_TOP + 1) * SYSTICK_PRESCALER)
+
+// Session being replayed: raw log and its edges (tick of debounced edge and buttons after it)
+static uint8_t session[RECORD_MAX_LEN];
+static uint16_t session_len;
+static uint32_t edge_tick[RECORD_MAX_LEN / 2];
+static uint8_t edge_mask[RECORD_MAX_LEN / 2];
+static uint16_t edges;
+static uint16_t scheduled;
+
+// Decodes edges of the session relative to record start, returns false when it is malformed
+static int decode(void) {
+	uint16_t i = 1 + sizeof(game_seed);
+	uint32_t t = 0;
+	uint8_t mask = 0;
+	edges = 0;
+	if (session_len < i)
+		return 0;
+	while (i < session_len) {
+		uint32_t v = 0;
+		uint8_t shift = 0;
+		uint8_t b;
+		do {
+			if (i == session_len || shift > 21)
+				return 0;
+			b = session[i++];
+			v |= (uint32_t)(b & 0x7f) << shift;
+			shift += 7;
+		} while (b & 0x80);
+		t += v >> 2;
+		mask ^= _BV(v & 3);
+		// simultaneous edges are one change of pins
+		if (edges > 0 && edge_tick[edges - 1] == t)
+			edges--;
+		edge_tick[edges] = t;
+		edge_mask[edges] = mask;
+		edges++;
+	}
+	return 1;
+}
+
+// Schedules pin changes of edges that come soon, base is system tick of record start
+static uint32_t base;
+
+static void hook(void) {
+	while (scheduled < edges) {
+		uint64_t at = (base + edge_tick[scheduled] - EDGE_TICKS) * TICK - TICK / 2;
+		if (at > sim_time + SCHEDULE_MS * SIM_MS)
+			break;
+		sim_set_buttons_at(edge_mask[scheduled], at);
+		scheduled++;
+	}
+}
+
+// Replays the session in this process, returns 0 when it is recorded the same
+static int replay(const char *name) {
+	sim_reset();
+	hal_init();
+	game_level = session[0];
+	memcpy(&game_seed, session + 1, sizeof(game_seed));
+	// debounced edges come on even ticks only, so record start has the parity of the first edge
+	if (edges > 0 && (systick_ms + edge_tick[0]) % DEBOUNCE_TICK_MS)
+		sleep_ms(1);
+	base = systick_ms; // ticks run from time 0, and the game starts within 65 seconds
+	scheduled = 0;
+	sim_ms_hook = hook;
+	uint8_t result = play_game();
+	record_stop();
+	printf("%s: level %u, %u edges, %s at position %u, ", name, game_level, edges,
+		result ? "WINNER" : "LOSER", game_position);
+	uint16_t i;
+	for (i = 0; i < session_len && i < record_len; i++)
+		if (record_log[i] != session[i])
+			break;
+	if (i == session_len && i == record_len) {
+		printf("replayed the same\n");
+		return 0;
+	}
+	printf("replay differs at byte %u of %u (%u replayed)\n", i, session_len, record_len);
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	int failed = 0;
+	int i;
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <session.rec>...\n", argv[0]);
+		return 2;
+	}
+	for (i = 1; i < argc; i++) {
+		FILE *f = fopen(argv[i], "rb");
+		if (!f) {
+			perror(argv[i]);
+			failed = 1;
+			continue;
+		}
+		session_len = fread(session, 1, sizeof(session), f);
+		fclose(f);
+		if (!decode()) {
+			fprintf(stderr, "%s: malformed session\n", argv[i]);
+			failed = 1;
+			continue;
+		}
+		// every session runs in a fresh process, as the firmware expects fresh variables
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid == 0) {
+			int differs = replay(argv[i]);
+			fflush(stdout);
+			_exit(differs);
+		}
+		int status;
+		waitpid(pid, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed = 1;
+	}
+	return failed;
+}
@@ -0,0 +1,147 @@
+#!/usr/bin/env python
+# Decodes Simon game telemetry (see telemetry.h) from a serial port or a file.
+# Usage: telemetry.py /dev/ttyUSB0 [baud] [--save prefix]   or   telemetry.py dump.bin [--save prefix]
+# With --save every recorded session is also saved into <prefix>NNN.rec for tools/replay.c.
+
+import sys
+
+SYNC = 0xa0
+FRAME_SIZE = 5
+
+LATENCY_KINDS = ("led", "sound")
+LATENCY_FIELDS = ("count", "min", "avg", "max")
+LATENCY_BUCKET0 = 8
+tick_us = None # Timer0 tick length from the latency dump
+
+def ticks(value):
+	if tick_us is None:
+		return "%d ticks" % value
+	return "%.3f ms" % (value * tick_us / 1000)
+
+def describe_latency(value, kind, field):
+	global tick_us
+	if field == 0xff:
+		tick_us = value / 256.0
+		return "latency tick=%.3f us" % tick_us
+	name = "latency " + (LATENCY_KINDS[kind] if kind < len(LATENCY_KINDS) else str(kind))
+	if field == 0:
+		return "%s count=%d" % (name, value)
+	if field < len(LATENCY_FIELDS):
+		return "%s %s=%s" % (name, LATENCY_FIELDS[field], ticks(value))
+	bucket = field - len(LATENCY_FIELDS)
+	hi = LATENCY_BUCKET0 << bucket
+	return "%s [%s, %s) %d" % (name, ticks(hi // 2 if bucket else 0), ticks(hi), value)
+
+def describe(type, a, b):
+	if type == 0xa0:
+		return "dropped %d event(s)" % a
+	if type == 0xa1:
+		return "start level=%d entropy=%d bits" % (a, b)
+	if type == 0xa2:
+		return "step pos=%d button=%d" % (a, b)
+	if type == 0xa3:
+		if a == 0:
+			return "press timeout"
+		return "press buttons=" + ",".join(str(i) for i in range(4) if a & (1 << i))
+	if type == 0xa4:
+		return "result %s level=%d" % (("LOSER", "WINNER")[a & 1], b)
+	return None
+
+record = None # session log being collected [seed size, bytes, some bytes were lost]
+save_prefix = None # where to save sessions
+saved = 0 # number of sessions saved
+
+def print_record(seed_size, truncated, log):
+	print("          session level=%d seed=0x%s%s" % (log[0],
+		"".join("%02x" % b for b in reversed(log[1:1 + seed_size])),
+		" (truncated)" if truncated else ""))
+	state = 0
+	t = 0
+	v = 0
+	shift = 0
+	for b in log[1 + seed_size:]:
+		v |= (b & 0x7f) << shift
+		shift += 7
+		if b & 0x80:
+			continue
+		t += v >> 2
+		state ^= 1 << (v & 3)
+		print("          %+6d ms %6d ms button %d %s" % (v >> 2, t, v & 3,
+			"pressed" if state & (1 << (v & 3)) else "released"))
+		v = 0
+		shift = 0
+
+def save_record(log):
+	global saved
+	name = "%s%03d.rec" % (save_prefix, saved)
+	with open(name, "wb") as f:
+		f.write(log)
+	saved += 1
+	print("          session saved to " + name)
+
+def describe_record(offset, a, b):
+	global record
+	if offset == 0xffff:
+		record = [a, bytearray(), False]
+	elif record is None:
+		pass # header was lost
+	elif offset == 0xfffe:
+		size = (a | (b << 8)) & 0x7fff
+		log = record[1][:size]
+		truncated = b & 0x80 or record[2] or len(log) < size
+		print_record(record[0], truncated, log)
+		if save_prefix is not None and not truncated:
+			save_record(log)
+		record = None
+	else:
+		if offset != len(record[1]): # frames were dropped
+			record[2] = True
+			record[1].extend(bytes(max(0, offset - len(record[1]))))
+		record[1][offset:offset + 2] = bytes([a, b])
+
+def decode(read):
+	buf = bytearray()
+	while True:
+		data = read()
+		if not data:
+			return
+		buf.extend(data)
+		while len(buf) >= FRAME_SIZE:
+			ms = buf[1] | (buf[2] << 8)
+			if buf[0] == 0xa5:
+				print("          " + describe_latency(ms, buf[3], buf[4]))
+				del buf[:FRAME_SIZE]
+				continue
+			if buf[0] == 0xa6:
+				describe_record(ms, buf[3], buf[4])
+				del buf[:FRAME_SIZE]
+				continue
+			text = describe(buf[0], buf[3], buf[4]) if buf[0] & 0xf0 == SYNC else None
+			if text is None:
+				del buf[0] # resynchronize on the next byte
+				continue
+			print("%5d.%03d %s" % (ms // 1000, ms % 1000, text))
+			sys.stdout.flush()
+			del buf[:FRAME_SIZE]
+
+def main():
+	global save_prefix
+	args = sys.argv[1:]
+	if "--save" in args:
+		i = args.index("--save")
+		if i + 1 >= len(args):
+			sys.exit("--save needs a prefix")
+		save_prefix = args[i + 1]
+		del args[i:i + 2]
+	if len(args) < 1:
+		sys.exit("Usage: %s <serial port or file> [baud] [--save prefix]" % sys.argv[0])
+	if args[0].startswith("/dev/") or args[0].upper().startswith("COM"):
+		import serial # pyserial
+		port = serial.Serial(args[0], int(args[1]) if len(args) > 1 else 9600)
+		decode(lambda: port.read(1))
+	else:
+		with open(args[0], "rb") as f:
+			decode(lambda: f.read(256))
+
+if __name__ == "__main__":
+	main()